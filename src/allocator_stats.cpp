@@ -0,0 +1,127 @@
+#include <cstdlib>
+#include <string>
+#include "allocator_stats.hpp"
+
+#if defined(__GNUC__)
+#include <cxxabi.h>
+#endif
+
+static std::atomic<AllocatorCounters*> g_allocator_counters = nullptr;
+static std::atomic<uint64_t> g_allocator_live_byte_count = 0;
+static std::atomic<uint64_t> g_allocator_peak_live_byte_count = 0;
+
+static void RaisePeak(std::atomic<uint64_t>& peak, uint64_t value)
+{
+    uint64_t current = peak.load(std::memory_order_relaxed);
+    while (value > current && !peak.compare_exchange_weak(current, value, std::memory_order_relaxed))
+    {
+    }
+}
+
+void RegisterAllocatorCounters(AllocatorCounters& counters, const char* type_name)
+{
+    if (counters.registered_.exchange(true))
+    {
+        return;
+    }
+
+    counters.type_name_ = type_name;
+    AllocatorCounters* head = g_allocator_counters.load();
+    do
+    {
+        counters.next_ = head;
+    } while (!g_allocator_counters.compare_exchange_weak(head, &counters));
+}
+
+void RecordMap(AllocatorCounters& counters, uint64_t byte_count, bool huge_page, bool huge_page_refused)
+{
+    counters.map_count_.fetch_add(1, std::memory_order_relaxed);
+    counters.mapped_byte_count_.fetch_add(byte_count, std::memory_order_relaxed);
+    if (huge_page) counters.huge_page_count_.fetch_add(1, std::memory_order_relaxed);
+    if (huge_page_refused) counters.huge_page_fallback_count_.fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t live = counters.live_byte_count_.fetch_add(byte_count, std::memory_order_relaxed) + byte_count;
+    RaisePeak(counters.peak_live_byte_count_, live);
+    uint64_t total_live = g_allocator_live_byte_count.fetch_add(byte_count, std::memory_order_relaxed) + byte_count;
+    RaisePeak(g_allocator_peak_live_byte_count, total_live);
+}
+
+void RecordUnmap(AllocatorCounters& counters, uint64_t byte_count, bool succeeded)
+{
+    counters.unmap_count_.fetch_add(1, std::memory_order_relaxed);
+    if (!succeeded)
+    {
+        // NOTE: The bytes stay mapped, so they also stay in the live counts.
+        counters.unmap_failure_count_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    counters.live_byte_count_.fetch_sub(byte_count, std::memory_order_relaxed);
+    g_allocator_live_byte_count.fetch_sub(byte_count, std::memory_order_relaxed);
+}
+
+void ResetAllocatorStats()
+{
+    for (AllocatorCounters* counters = g_allocator_counters.load(); counters; counters = counters->next_)
+    {
+        counters->map_count_ = 0;
+        counters->unmap_count_ = 0;
+        counters->unmap_failure_count_ = 0;
+        counters->huge_page_count_ = 0;
+        counters->huge_page_fallback_count_ = 0;
+        counters->mapped_byte_count_ = 0;
+        counters->peak_live_byte_count_ = counters->live_byte_count_.load();
+    }
+    g_allocator_peak_live_byte_count = g_allocator_live_byte_count.load();
+}
+
+static std::string DemangledTypeName(const char* type_name)
+{
+    std::string result = type_name ? type_name : "?";
+#if defined(__GNUC__)
+    int status = 0;
+    char* demangled = abi::__cxa_demangle(result.c_str(), nullptr, nullptr, &status);
+    if (status == 0 && demangled)
+    {
+        result = demangled;
+    }
+    free(demangled);
+#endif
+    return result;
+}
+
+void PrintAllocatorStats(FILE* out, uint64_t page_fault_count)
+{
+    double megabyte = 1024.0 * 1024.0;
+    uint64_t map_count = 0, huge_page_count = 0, fallback_count = 0, failure_count = 0;
+    for (AllocatorCounters* counters = g_allocator_counters.load(); counters; counters = counters->next_)
+    {
+        map_count += counters->map_count_;
+        huge_page_count += counters->huge_page_count_;
+        fallback_count += counters->huge_page_fallback_count_;
+        failure_count += counters->unmap_failure_count_;
+    }
+
+    fprintf(out, "\nAllocator: %llu maps, %llu huge-page backed, %llu fell back to small pages; peak %.3fmb live; %llu page faults\n",
+            (unsigned long long)map_count, (unsigned long long)huge_page_count, (unsigned long long)fallback_count,
+            (double)g_allocator_peak_live_byte_count.load() / megabyte, (unsigned long long)page_fault_count);
+    for (AllocatorCounters* counters = g_allocator_counters.load(); counters; counters = counters->next_)
+    {
+        if (!counters->map_count_ && !counters->unmap_count_)
+        {
+            continue; // nothing this type did falls inside the profiled window
+        }
+        fprintf(out, "  %s: %llu maps (%llu huge), %llu unmaps, %.3fmb mapped, peak %.3fmb live\n",
+                DemangledTypeName(counters->type_name_).c_str(),
+                (unsigned long long)counters->map_count_.load(), (unsigned long long)counters->huge_page_count_.load(),
+                (unsigned long long)counters->unmap_count_.load(),
+                (double)counters->mapped_byte_count_.load() / megabyte, (double)counters->peak_live_byte_count_.load() / megabyte);
+    }
+    if (fallback_count && !huge_page_count)
+    {
+        fprintf(out, "  NOTE: no huge pages were granted; check vm.nr_hugepages (Linux) or the Lock Pages in Memory right (Windows)\n");
+    }
+    if (failure_count)
+    {
+        fprintf(out, "  WARNING: %llu unmaps failed and leaked their pages\n", (unsigned long long)failure_count);
+    }
+}
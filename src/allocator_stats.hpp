@@ -0,0 +1,31 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+
+// NOTE: Counters for one CustomMemoryAllocator<T> instantiation. Its allocations are few and
+// large, so relaxed atomics on every call cost nothing measurable and keep workers safe.
+struct AllocatorCounters
+{
+    const char* type_name_;                          // mangled, demangled when printed
+    std::atomic<uint64_t> map_count_;
+    std::atomic<uint64_t> unmap_count_;
+    std::atomic<uint64_t> unmap_failure_count_;
+    std::atomic<uint64_t> huge_page_count_;          // mappings backed by MAP_HUGETLB / MEM_LARGE_PAGES
+    std::atomic<uint64_t> huge_page_fallback_count_; // huge pages were refused, small pages used instead
+    std::atomic<uint64_t> mapped_byte_count_;        // every byte ever mapped
+    std::atomic<uint64_t> live_byte_count_;
+    std::atomic<uint64_t> peak_live_byte_count_;
+    std::atomic<bool> registered_;
+    AllocatorCounters* next_;
+};
+
+// NOTE: Adds counters to the list PrintAllocatorStats walks; safe to call more than once.
+void RegisterAllocatorCounters(AllocatorCounters& counters, const char* type_name);
+void RecordMap(AllocatorCounters& counters, uint64_t byte_count, bool huge_page, bool huge_page_refused);
+void RecordUnmap(AllocatorCounters& counters, uint64_t byte_count, bool succeeded);
+// NOTE: Starts a new window, as BeginProfile does for every server request, so the counts
+// cover the same span as the page faults they are printed with. Live bytes carry over and
+// seed the peaks.
+void ResetAllocatorStats();
+void PrintAllocatorStats(FILE* out, uint64_t page_fault_count);
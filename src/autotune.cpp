@@ -0,0 +1,308 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "autotune.hpp"
+#include "json_parser.hpp"
+#include "platform_metrics.hpp"
+#include "repetition_tester.hpp"
+#include "thread_pool.hpp"
+#include "timer_calibration.hpp"
+
+static const char* parser_names[] = { "generic", "schema" };
+static const char* read_strategy_names[] = { "fread", "mmap" };
+
+bool SaveTunedConfig(const std::string& path, const TunedConfig& tuned)
+{
+    std::ofstream file(path, std::ios::trunc);
+    file << TUNED_PROFILE_HEADER << " " << TUNED_PROFILE_VERSION << "\n";
+    file << "cpu " << tuned.cpu_signature_ << "\n";
+    file << "threads " << tuned.config_.thread_count_ << "\n";
+    file << "chunk_size " << tuned.config_.haversine_chunk_size_ << "\n";
+    file << "parser " << parser_names[tuned.config_.parser_] << "\n";
+    file << "read " << read_strategy_names[tuned.config_.read_strategy_] << "\n";
+    file << "pages " << PagePolicyName(tuned.page_policy_) << "\n";
+    return (bool)file;
+}
+
+bool LoadTunedConfig(const std::string& path, TunedConfig& tuned)
+{
+    std::ifstream file(path);
+    std::string header;
+    uint32_t version = 0;
+    if (!(file >> header >> version) || header != TUNED_PROFILE_HEADER || version != TUNED_PROFILE_VERSION)
+    {
+        return false;
+    }
+
+    tuned.config_ = g_config;
+    tuned.page_policy_ = g_page_policy;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::istringstream fields(line);
+        std::string key, value;
+        fields >> key >> value;
+        if (key == "cpu") tuned.cpu_signature_ = value;
+        else if (key == "threads") tuned.config_.thread_count_ = (uint32_t)strtoul(value.c_str(), nullptr, 10);
+        else if (key == "chunk_size") tuned.config_.haversine_chunk_size_ = std::max<uint64_t>(1, strtoull(value.c_str(), nullptr, 10));
+        else if (key == "parser" && !ParseJsonParser(value.c_str(), tuned.config_.parser_)) return false;
+        else if (key == "read" && !ParseReadStrategy(value.c_str(), tuned.config_.read_strategy_)) return false;
+        else if (key == "pages" && !ParsePagePolicy(value.c_str(), tuned.page_policy_)) return false;
+    }
+    return true;
+}
+
+std::string DescribeEffectiveConfig()
+{
+    uint32_t thread_count = g_config.thread_count_ ? g_config.thread_count_ : std::max(1u, std::thread::hardware_concurrency());
+    char text[160];
+    snprintf(text, sizeof(text), "threads %u, chunk %llu, parser %s, read %s, pages %s", thread_count,
+             (unsigned long long)g_config.haversine_chunk_size_, parser_names[g_config.parser_],
+             read_strategy_names[g_config.read_strategy_], PagePolicyName(g_page_policy));
+    return text;
+}
+
+std::string GetTunedProfilePath()
+{
+    std::string directory = GetCacheDirectory();
+    if (directory.empty())
+    {
+        return "";
+    }
+    return (std::filesystem::path(directory) / ("tuned-" + GetCPUSignature())).string();
+}
+
+bool ApplyHostTunedConfig()
+{
+    std::string path = GetTunedProfilePath();
+    TunedConfig tuned;
+    if (path.empty() || !std::filesystem::exists(path) || !LoadTunedConfig(path, tuned) || tuned.cpu_signature_ != GetCPUSignature())
+    {
+        return false;
+    }
+    g_config = tuned.config_;
+    g_page_policy = tuned.page_policy_;
+    printf("Using tuned profile %s\n", path.c_str());
+    return true;
+}
+
+// NOTE: The input cut after the last whole pair within sample_bytes and closed off again, so
+// it is still valid JSON. Returns false when the whole file is small enough to use as is.
+static bool WriteSampleFile(const char* data, uint64_t size, uint64_t sample_bytes, const std::string& sample_path)
+{
+    if (size <= sample_bytes)
+    {
+        return false;
+    }
+
+    const char* end = data + size;
+    const char* array = FindPointsArray(data, end);
+    if (!array)
+    {
+        return false;
+    }
+
+    CustomVector(Point) points;
+    const char* sample_end = ParsePointObjects(array, data + sample_bytes, end, points);
+    FILE* file = fopen(sample_path.c_str(), "wb");
+    if (!file)
+    {
+        return false;
+    }
+    static const char closing[] = "\n]}\n";
+    bool written = fwrite(data, 1, sample_end - data, file) == (size_t)(sample_end - data) &&
+                   fwrite(closing, 1, sizeof(closing) - 1, file) == sizeof(closing) - 1;
+    written = (fclose(file) == 0) && written;
+    return written;
+}
+
+struct TrialResult
+{
+    bool valid_;
+    double seconds_;
+    uint64_t point_count_;
+    double sum_;
+};
+
+// NOTE: One pass of what a normal file run does, under whatever g_config currently says.
+static bool RunPipeline(const std::string& path, uint64_t& byte_count, uint64_t& point_count, double& sum)
+{
+    CustomVector(char) buffer;
+    MappedFile file = {};
+    const char* json = nullptr;
+    if (g_config.read_strategy_ == READ_MMAP)
+    {
+        if (!MapPointsFile(path, file))
+        {
+            return false;
+        }
+        json = file.data_;
+        byte_count = file.size_;
+    }
+    else
+    {
+        byte_count = ReadPointsJson(path, buffer);
+        json = buffer.data();
+    }
+
+    CustomVector(Point) points;
+    ProcessJson(json, byte_count, points, g_config.release_input_);
+    CustomVector(double) haversine_vals;
+    ComputeHaversine(points, haversine_vals);
+    sum = SumHaversine(haversine_vals);
+    point_count = points.size();
+    UnmapPointsFile(file);
+    return byte_count != 0;
+}
+
+static TrialResult RunTrial(const std::string& path, uint64_t byte_count, uint32_t seconds_to_try)
+{
+    printf("\n--- %s ---\n", DescribeEffectiveConfig().c_str());
+
+    uint64_t timer_freq = GetCPUTimerFreq();
+    RepetitionTester tester = {};
+    NewTestWave(tester, byte_count, timer_freq, seconds_to_try);
+    tester.print_new_minimums_ = false;
+
+    TrialResult result = { true, 0, 0, 0 };
+    bool first = true;
+    while (IsTesting(tester))
+    {
+        uint64_t processed = 0, point_count = 0;
+        double sum = 0;
+        BeginTime(tester);
+        bool ran = RunPipeline(path, processed, point_count, sum);
+        EndTime(tester);
+        CountBytes(tester, processed);
+        if (!ran)
+        {
+            Error(tester, "Pipeline failed");
+        }
+
+        // NOTE: Every repetition has to agree with the first, bit for bit.
+        if (first)
+        {
+            result.point_count_ = point_count;
+            result.sum_ = sum;
+            first = false;
+        }
+        result.valid_ = result.valid_ && ran && point_count == result.point_count_ && sum == result.sum_;
+    }
+
+    result.valid_ = result.valid_ && tester.mode_ != TestMode::ERRORR;
+    result.seconds_ = SecondsFromCpuTime((double)tester.results_.min_.e[RepetitionValueType::CPUTIMER], timer_freq);
+    return result;
+}
+
+int RunAutotune(int argc, char* argv[])
+{
+    const char* filename = nullptr;
+    uint64_t sample_bytes = AUTOTUNE_SAMPLE_BYTES;
+    uint32_t seconds_to_try = 1;
+    for (int arg_index = 0; arg_index < argc; ++arg_index)
+    {
+        std::string_view arg = argv[arg_index];
+        if (arg == "--sample" && arg_index + 1 < argc) sample_bytes = strtoull(argv[++arg_index], nullptr, 10) << 20;
+        else if (arg == "--seconds" && arg_index + 1 < argc) seconds_to_try = (uint32_t)strtoul(argv[++arg_index], nullptr, 10);
+        else filename = argv[arg_index];
+    }
+    if (!filename)
+    {
+        std::cerr << "      Usage: autotune <filename.json> [--sample MB] [--seconds N]" << std::endl;
+        return 1;
+    }
+
+    std::string profile_path = GetTunedProfilePath();
+    if (profile_path.empty())
+    {
+        std::cerr << "No cache directory to save the tuned profile in" << std::endl;
+        return 1;
+    }
+
+    std::string sample_path = filename;
+    {
+        MappedFile input;
+        if (!MapPointsFile(filename, input))
+        {
+            return 1;
+        }
+        std::string candidate = (std::filesystem::path(GetCacheDirectory()) / "autotune-sample.json").string();
+        if (WriteSampleFile(input.data_, input.size_, sample_bytes, candidate))
+        {
+            sample_path = candidate;
+        }
+        UnmapPointsFile(input);
+    }
+    uint64_t sample_size = std::filesystem::file_size(sample_path);
+
+    // NOTE: Coordinate descent: each setting is swept with the others held at the best found
+    // so far, about a dozen trials instead of the full cross product. A trial only counts if
+    // it reproduces the reference point count and sum exactly.
+    uint32_t hardware_threads = std::max(1u, std::thread::hardware_concurrency());
+    g_config.thread_count_ = hardware_threads;
+    StartThreadPool(g_thread_pool, g_config.thread_count_);
+    TrialResult best = RunTrial(sample_path, sample_size, seconds_to_try);
+    if (!best.valid_)
+    {
+        std::cerr << "Reference trial failed" << std::endl;
+        if (sample_path != filename) remove(sample_path.c_str());
+        return 1;
+    }
+    TrialResult reference = best;
+
+    auto try_setting = [&](auto& setting, auto candidate)
+    {
+        auto previous = setting;
+        if (previous == candidate) return;
+        setting = candidate;
+        StartThreadPool(g_thread_pool, g_config.thread_count_);
+        TrialResult trial = RunTrial(sample_path, sample_size, seconds_to_try);
+        bool valid = trial.valid_ && trial.point_count_ == reference.point_count_ && trial.sum_ == reference.sum_;
+        if (!valid) printf("  rejected: result differs from the reference run\n");
+        if (valid && trial.seconds_ < best.seconds_)
+        {
+            best = trial;
+        }
+        else
+        {
+            setting = previous;
+        }
+    };
+
+    for (JsonParser parser : { PARSER_GENERIC, PARSER_SCHEMA }) try_setting(g_config.parser_, parser);
+    for (ReadStrategy strategy : { READ_FREAD, READ_MMAP }) try_setting(g_config.read_strategy_, strategy);
+    for (PagePolicy policy : { PAGES_HUGE, PAGES_TRANSPARENT, PAGES_SMALL }) try_setting(g_page_policy, policy);
+    std::vector<uint32_t> thread_counts;
+    for (uint32_t thread_count = 1; thread_count < hardware_threads; thread_count *= 2) thread_counts.push_back(thread_count);
+    thread_counts.push_back(hardware_threads);
+    for (uint32_t thread_count : thread_counts) try_setting(g_config.thread_count_, thread_count);
+    for (uint64_t chunk_size : { 1ull << 12, 1ull << 14, 1ull << 16, 1ull << 18 }) try_setting(g_config.haversine_chunk_size_, chunk_size);
+    StartThreadPool(g_thread_pool, g_config.thread_count_);
+
+    if (sample_path != filename)
+    {
+        remove(sample_path.c_str());
+    }
+
+    TunedConfig tuned = { GetCPUSignature(), g_config, g_page_policy };
+    double gigabyte = 1024.0 * 1024.0 * 1024.0;
+    printf("\nBest on %s: %s\n", tuned.cpu_signature_.c_str(), DescribeEffectiveConfig().c_str());
+    printf("  %.3fms (%.3fgb/s) against %.3fms for the starting configuration, on a %.3fmb sample\n",
+           1000.0 * best.seconds_, (double)sample_size / gigabyte / best.seconds_, 1000.0 * reference.seconds_,
+           (double)sample_size / (1024.0 * 1024.0));
+
+    if (!SaveTunedConfig(profile_path, tuned))
+    {
+        std::cerr << "Could not save tuned profile: " << profile_path << std::endl;
+        return 1;
+    }
+    printf("Saved to %s\n", profile_path.c_str());
+    return 0;
+}
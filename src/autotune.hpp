@@ -0,0 +1,27 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include "haversine_processor.hpp"
+
+#define TUNED_PROFILE_HEADER "haversine-tuned"
+#define TUNED_PROFILE_VERSION 1
+#define AUTOTUNE_SAMPLE_BYTES (32ull << 20)
+
+// NOTE: Everything the autotuner picks. Thread count and chunk size are stored as measured,
+// never as the "all hardware threads" 0.
+struct TunedConfig
+{
+    std::string cpu_signature_;
+    ProcessorConfig config_;
+    PagePolicy page_policy_;
+};
+
+bool SaveTunedConfig(const std::string& path, const TunedConfig& tuned);
+bool LoadTunedConfig(const std::string& path, TunedConfig& tuned);
+// NOTE: g_config and g_page_policy as a run would use them, with "all threads" resolved.
+std::string DescribeEffectiveConfig();
+std::string GetTunedProfilePath();
+// NOTE: Applies the profile 'autotune' saved for this CPU to g_config and g_page_policy, if
+// there is one. Called before options are parsed, so explicit options still win.
+bool ApplyHostTunedConfig();
+int RunAutotune(int argc, char* argv[]);
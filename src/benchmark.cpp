@@ -0,0 +1,385 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string_view>
+#include "benchmark.hpp"
+#include "autotune.hpp"
+#include "haversine_processor.hpp"
+#include "platform_metrics.hpp"
+#include "timer_calibration.hpp"
+
+BenchmarkResult ResultFromTester(const char* stage, const char* variant, const RepetitionTester& tester)
+{
+    const RepetitionTestResults& results = tester.results_;
+    BenchmarkResult result;
+    result.stage_ = stage;
+    result.variant_ = variant;
+    result.min_cycles_ = results.min_.e[RepetitionValueType::CPUTIMER];
+    result.max_cycles_ = results.max_.e[RepetitionValueType::CPUTIMER];
+    result.typical_cycles_ = TypicalFastCpuTime(results);
+    result.page_faults_ = results.min_.e[RepetitionValueType::MEMPAGEFAULTS];
+    result.byte_count_ = tester.target_processed_byte_count_;
+    result.failed_ = tester.mode_ == TestMode::ERRORR || result.min_cycles_ == (uint64_t)-1 || result.typical_cycles_ == 0;
+    return result;
+}
+
+double ResultGigabytesPerSecond(const BenchmarkResult& result, uint64_t timer_freq)
+{
+    double seconds = SecondsFromCpuTime((double)result.min_cycles_, timer_freq);
+    double gigabyte = 1024.0 * 1024.0 * 1024.0;
+    return seconds > 0 ? (double)result.byte_count_ / (gigabyte * seconds) : 0;
+}
+
+bool SaveBaseline(const std::string& path, const BenchmarkBaseline& baseline)
+{
+    std::ofstream file(path, std::ios::trunc);
+    file << BASELINE_FILE_HEADER << " " << BASELINE_FILE_VERSION << "\n";
+    file << "cpu " << baseline.cpu_signature_ << "\n";
+    file << "config " << baseline.config_ << "\n";
+    file << "timer_freq " << baseline.timer_freq_ << "\n";
+    file << "# stage variant min_cycles max_cycles typical_cycles page_faults bytes gb_per_s\n";
+    for (const BenchmarkResult& result : baseline.results_)
+    {
+        file << "result " << result.stage_ << " " << result.variant_ << " " << result.min_cycles_ << " "
+             << result.max_cycles_ << " " << result.typical_cycles_ << " " << result.page_faults_ << " " << result.byte_count_ << " "
+             << ResultGigabytesPerSecond(result, baseline.timer_freq_) << "\n";
+    }
+    return (bool)file;
+}
+
+bool LoadBaseline(const std::string& path, BenchmarkBaseline& baseline)
+{
+    std::ifstream file(path);
+    std::string header;
+    uint32_t version = 0;
+    if (!(file >> header >> version) || header != BASELINE_FILE_HEADER)
+    {
+        std::cerr << "Not a baseline file: " << path << std::endl;
+        return false;
+    }
+    if (version != 1 && version != BASELINE_FILE_VERSION)
+    {
+        std::cerr << "Unsupported baseline version " << version << " in " << path << std::endl;
+        return false;
+    }
+
+    baseline = {};
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::istringstream fields(line);
+        std::string kind;
+        fields >> kind;
+        if (kind == "cpu") fields >> baseline.cpu_signature_;
+        else if (kind == "config") std::getline(fields >> std::ws, baseline.config_);
+        else if (kind == "timer_freq") fields >> baseline.timer_freq_;
+        else if (kind == "result")
+        {
+            BenchmarkResult result = {};
+            fields >> result.stage_ >> result.variant_ >> result.min_cycles_ >> result.max_cycles_;
+            if (version == 1) result.typical_cycles_ = result.max_cycles_;
+            else fields >> result.typical_cycles_;
+            if (fields >> result.page_faults_ >> result.byte_count_)
+            {
+                baseline.results_.push_back(result);
+            }
+        }
+    }
+    return true;
+}
+
+// NOTE: Spread of the fastest repetitions only; the slowest run is usually the cold first one,
+// and letting it set the noise pinned most thresholds at BASELINE_MAX_THRESHOLD.
+static double ResultSpread(const BenchmarkResult& result)
+{
+    return result.min_cycles_ ? (double)(result.typical_cycles_ - result.min_cycles_) / (double)result.min_cycles_ : 0;
+}
+
+uint32_t CompareToBaseline(const BenchmarkBaseline& baseline, const BenchmarkBaseline& current)
+{
+    if (baseline.cpu_signature_ != current.cpu_signature_)
+    {
+        printf("WARNING: baseline was recorded on %s, this is %s\n", baseline.cpu_signature_.c_str(), current.cpu_signature_.c_str());
+    }
+    if (baseline.config_ != current.config_)
+    {
+        printf("WARNING: baseline was recorded with %s, this run uses %s\n",
+               baseline.config_.empty() ? "an unrecorded configuration" : baseline.config_.c_str(), current.config_.c_str());
+    }
+
+    uint32_t regression_count = 0;
+    printf("\n%-16s %-8s %10s %10s %8s %8s  %s\n", "Stage", "Variant", "Base gb/s", "Now gb/s", "Change", "Noise", "Verdict");
+    for (const BenchmarkResult& now : current.results_)
+    {
+        if (now.failed_)
+        {
+            printf("%-16s %-8s %10s %10s %8s %8s  FAILED\n", now.stage_.c_str(), now.variant_.c_str(), "-", "-", "-", "-");
+            ++regression_count;
+            continue;
+        }
+
+        auto match = std::find_if(baseline.results_.begin(), baseline.results_.end(), [&](const BenchmarkResult& base)
+        {
+            return base.stage_ == now.stage_ && base.variant_ == now.variant_;
+        });
+        if (match == baseline.results_.end())
+        {
+            printf("%-16s %-8s %10s %10.3f %8s %8s  new\n", now.stage_.c_str(), now.variant_.c_str(), "-",
+                   ResultGigabytesPerSecond(now, current.timer_freq_), "-", "-");
+            continue;
+        }
+
+        // NOTE: Compared in bytes per second rather than cycles so a change of timer
+        // frequency between the two runs doesn't read as a regression.
+        double base_rate = ResultGigabytesPerSecond(*match, baseline.timer_freq_);
+        double now_rate = ResultGigabytesPerSecond(now, current.timer_freq_);
+        double change = base_rate > 0 ? now_rate / base_rate - 1.0 : 0;
+        double noise = std::max(ResultSpread(*match), ResultSpread(now));
+        double threshold = std::clamp(noise, BASELINE_MIN_THRESHOLD, BASELINE_MAX_THRESHOLD);
+
+        const char* verdict = "ok";
+        if (change < -threshold)
+        {
+            verdict = "REGRESSED";
+            ++regression_count;
+        }
+        else if (change > threshold)
+        {
+            verdict = "improved";
+        }
+
+        printf("%-16s %-8s %10.3f %10.3f %+7.1f%% %7.1f%%  %s\n", now.stage_.c_str(), now.variant_.c_str(),
+               base_rate, now_rate, 100.0 * change, 100.0 * threshold, verdict);
+    }
+
+    for (const BenchmarkResult& base : baseline.results_)
+    {
+        auto match = std::find_if(current.results_.begin(), current.results_.end(), [&](const BenchmarkResult& now)
+        {
+            return base.stage_ == now.stage_ && base.variant_ == now.variant_;
+        });
+        if (match == current.results_.end())
+        {
+            printf("%-16s %-8s %10.3f %10s %8s %8s  MISSING\n", base.stage_.c_str(), base.variant_.c_str(),
+                   ResultGigabytesPerSecond(base, baseline.timer_freq_), "-", "-", "-");
+            ++regression_count;
+        }
+    }
+    return regression_count;
+}
+
+static void PrintStageHeader(const char* stage, const char* variant)
+{
+    printf("\n--- %s (%s) ---\n", stage, variant);
+}
+
+int RunBenchmark(int argc, char* argv[])
+{
+    const char* filename = nullptr;
+    const char* save_path = nullptr;
+    const char* compare_path = nullptr;
+    uint32_t seconds_to_try = 3;
+    for (int arg_index = 0; arg_index < argc; ++arg_index)
+    {
+        std::string_view arg = argv[arg_index];
+        if (arg == "--save" && arg_index + 1 < argc) save_path = argv[++arg_index];
+        else if (arg == "--compare" && arg_index + 1 < argc) compare_path = argv[++arg_index];
+        else if (arg == "--seconds" && arg_index + 1 < argc) seconds_to_try = (uint32_t)strtoul(argv[++arg_index], nullptr, 10);
+        else filename = argv[arg_index];
+    }
+    if (!filename)
+    {
+        std::cerr << "      Usage: bench <filename.json> [--seconds N] [--save <baseline>] [--compare <baseline>]" << std::endl;
+        return 1;
+    }
+
+    BenchmarkBaseline baseline;
+    if (compare_path && !LoadBaseline(compare_path, baseline))
+    {
+        return 1;
+    }
+
+    BenchmarkBaseline current;
+    current.cpu_signature_ = GetCPUSignature();
+    current.config_ = DescribeEffectiveConfig();
+    current.timer_freq_ = GetCPUTimerFreq();
+    uint64_t timer_freq = current.timer_freq_;
+
+    CustomVector(char) json;
+    uint64_t file_size = ReadPointsJson(filename, json);
+    if (file_size == 0)
+    {
+        return 1;
+    }
+
+    {
+        PrintStageHeader("ReadFile", "fread");
+        RepetitionTester tester = {};
+        NewTestWave(tester, file_size, timer_freq, seconds_to_try);
+        while (IsTesting(tester))
+        {
+            CustomVector(char) buffer;
+            BeginTime(tester);
+            uint64_t read_size = ReadPointsJson(filename, buffer);
+            EndTime(tester);
+            CountBytes(tester, read_size);
+        }
+        current.results_.push_back(ResultFromTester("ReadFile", "fread", tester));
+    }
+
+    {
+        PrintStageHeader("ReadFile", "mmap");
+        RepetitionTester tester = {};
+        NewTestWave(tester, file_size, timer_freq, seconds_to_try);
+        while (IsTesting(tester))
+        {
+            MappedFile file;
+            BeginTime(tester);
+            if (MapPointsFile(filename, file))
+            {
+                // NOTE: Touch every page so the mapping is charged for actually bringing the bytes in.
+                char touched = 0;
+                for (uint64_t offset = 0; offset < file.size_; offset += 4096)
+                {
+                    touched ^= file.data_[offset];
+                }
+                volatile char sink = touched;
+                (void)sink;
+                CountBytes(tester, file.size_);
+            }
+            EndTime(tester);
+            UnmapPointsFile(file);
+        }
+        current.results_.push_back(ResultFromTester("ReadFile", "mmap", tester));
+    }
+
+    CustomVector(Point) points;
+    JsonParser configured_parser = g_config.parser_;
+    static const struct { JsonParser parser_; const char* name_; } parsers[] =
+    {
+        { PARSER_GENERIC, "generic" },
+        { PARSER_SCHEMA, "schema" },
+    };
+    for (auto& parser : parsers)
+    {
+        PrintStageHeader("ProcessJson", parser.name_);
+        g_config.parser_ = parser.parser_;
+        RepetitionTester tester = {};
+        NewTestWave(tester, file_size, timer_freq, seconds_to_try);
+        while (IsTesting(tester))
+        {
+            points.clear();
+            BeginTime(tester);
+            ProcessJson(json.data(), file_size, points);
+            EndTime(tester);
+            CountBytes(tester, file_size);
+        }
+        current.results_.push_back(ResultFromTester("ProcessJson", parser.name_, tester));
+    }
+    g_config.parser_ = configured_parser;
+
+    CustomVector(double) haversine_vals;
+    {
+        PrintStageHeader("Haversine", "reference");
+        uint64_t byte_count = points.size() * sizeof(Point);
+        RepetitionTester tester = {};
+        NewTestWave(tester, byte_count, timer_freq, seconds_to_try);
+        while (IsTesting(tester))
+        {
+            BeginTime(tester);
+            ComputeHaversine(points, haversine_vals);
+            EndTime(tester);
+            CountBytes(tester, byte_count);
+        }
+        current.results_.push_back(ResultFromTester("Haversine", "reference", tester));
+    }
+
+    // NOTE: The compact stages use the configured parser; the Haversine byte count is the
+    // 16-byte pairs it actually reads, so the two Haversine rows compare memory traffic too.
+    CustomVector(CompactPoint) compact_points;
+    {
+        PrintStageHeader("ProcessJson", "compact");
+        RepetitionTester tester = {};
+        NewTestWave(tester, file_size, timer_freq, seconds_to_try);
+        while (IsTesting(tester))
+        {
+            compact_points.clear();
+            BeginTime(tester);
+            ProcessJson(json.data(), file_size, compact_points);
+            EndTime(tester);
+            CountBytes(tester, file_size);
+        }
+        current.results_.push_back(ResultFromTester("ProcessJson", "compact", tester));
+    }
+
+    {
+        PrintStageHeader("Haversine", "compact");
+        CustomVector(double) compact_vals;
+        uint64_t byte_count = compact_points.size() * sizeof(CompactPoint);
+        RepetitionTester tester = {};
+        NewTestWave(tester, byte_count, timer_freq, seconds_to_try);
+        while (IsTesting(tester))
+        {
+            BeginTime(tester);
+            ComputeHaversine(compact_points, compact_vals);
+            EndTime(tester);
+            CountBytes(tester, byte_count);
+        }
+        current.results_.push_back(ResultFromTester("Haversine", "compact", tester));
+    }
+
+    {
+        PrintStageHeader("SumHaversine", "scalar");
+        uint64_t byte_count = haversine_vals.size() * sizeof(double);
+        RepetitionTester tester = {};
+        NewTestWave(tester, byte_count, timer_freq, seconds_to_try);
+        volatile double sink = 0;
+        (void)sink;
+        while (IsTesting(tester))
+        {
+            BeginTime(tester);
+            sink = SumHaversine(haversine_vals);
+            EndTime(tester);
+            CountBytes(tester, byte_count);
+        }
+        current.results_.push_back(ResultFromTester("SumHaversine", "scalar", tester));
+    }
+
+    uint32_t failed_count = 0;
+    for (const BenchmarkResult& result : current.results_)
+    {
+        if (result.failed_)
+        {
+            printf("\nStage %s (%s) failed\n", result.stage_.c_str(), result.variant_.c_str());
+            ++failed_count;
+        }
+    }
+
+    if (save_path && failed_count)
+    {
+        std::cerr << "Not saving a baseline with failed stages: " << save_path << std::endl;
+    }
+    else if (save_path)
+    {
+        if (!SaveBaseline(save_path, current))
+        {
+            std::cerr << "Could not write baseline: " << save_path << std::endl;
+            return 1;
+        }
+        printf("\nSaved baseline to %s\n", save_path);
+    }
+
+    if (compare_path)
+    {
+        uint32_t regression_count = CompareToBaseline(baseline, current);
+        if (regression_count)
+        {
+            printf("\n%u stage(s) regressed, failed or went missing against %s\n", regression_count, compare_path);
+            return 2;
+        }
+    }
+    return failed_count ? 1 : 0;
+}
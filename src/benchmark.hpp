@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "repetition_tester.hpp"
+
+#define BASELINE_FILE_HEADER "haversine-baseline"
+#define BASELINE_FILE_VERSION 2
+
+// NOTE: A regression is only called when the slowdown is larger than the run-to-run spread
+// of the fastest repetitions, and never for less than the floor.
+#define BASELINE_MIN_THRESHOLD 0.03
+#define BASELINE_MAX_THRESHOLD 0.25
+
+struct BenchmarkResult
+{
+    std::string stage_;
+    std::string variant_;
+    uint64_t min_cycles_;
+    uint64_t max_cycles_;
+    uint64_t typical_cycles_; // TypicalFastCpuTime; version 1 baselines only had max_cycles_
+    uint64_t page_faults_;    // on the fastest repetition
+    uint64_t byte_count_;
+    bool failed_;             // the repetition tester hit an error, the timings mean nothing
+};
+
+struct BenchmarkBaseline
+{
+    std::string cpu_signature_;
+    std::string config_; // DescribeEffectiveConfig, empty in baselines that predate it
+    uint64_t timer_freq_;
+    std::vector<BenchmarkResult> results_;
+};
+
+BenchmarkResult ResultFromTester(const char* stage, const char* variant, const RepetitionTester& tester);
+double ResultGigabytesPerSecond(const BenchmarkResult& result, uint64_t timer_freq);
+bool SaveBaseline(const std::string& path, const BenchmarkBaseline& baseline);
+bool LoadBaseline(const std::string& path, BenchmarkBaseline& baseline);
+// NOTE: Prints a verdict per stage and returns the number of regressions.
+uint32_t CompareToBaseline(const BenchmarkBaseline& baseline, const BenchmarkBaseline& current);
+int RunBenchmark(int argc, char* argv[]);
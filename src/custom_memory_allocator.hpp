@@ -6,8 +6,61 @@
 #endif
 #include <cstddef>
 #include <cstdlib>
+#include <algorithm>
 #include <iostream>
+#include <mutex>
 #include <new>
+#include <string_view>
+#include <typeinfo>
+#include <vector>
+#include "allocator_stats.hpp"
+
+#if defined(__linux__)
+#include <cstdio>
+
+// NOTE: The default hugetlb page size from /proc/meminfo, 2MB if it can't be read.
+inline std::size_t LinuxHugePageSize()
+{
+    static std::size_t huge_page_size = []
+    {
+        std::size_t kilobytes = 0;
+        if (FILE* meminfo = fopen("/proc/meminfo", "r")) {
+            char line[128];
+            while (fgets(line, sizeof(line), meminfo)) {
+                if (sscanf(line, "Hugepagesize: %zu kB", &kilobytes) == 1) break;
+            }
+            fclose(meminfo);
+        }
+        return kilobytes ? kilobytes * 1024 : (std::size_t)2 << 20;
+    }();
+    return huge_page_size;
+}
+#endif
+
+enum PagePolicy : uint32_t
+{
+    PAGES_HUGE,        // explicit huge pages (MAP_HUGETLB / MEM_LARGE_PAGES), small pages when refused
+    PAGES_TRANSPARENT, // small-page mappings marked MADV_HUGEPAGE so transparent huge pages can back them
+    PAGES_SMALL,       // small pages only, MADV_NOHUGEPAGE
+};
+
+inline PagePolicy g_page_policy = PAGES_HUGE;
+
+inline const char* PagePolicyName(PagePolicy policy)
+{
+    static const char* names[] = { "huge", "thp", "small" };
+    return policy <= PAGES_SMALL ? names[policy] : "?";
+}
+
+inline bool ParsePagePolicy(const char* name, PagePolicy& policy)
+{
+    std::string_view value = name;
+    if (value == "huge") policy = PAGES_HUGE;
+    else if (value == "thp") policy = PAGES_TRANSPARENT;
+    else if (value == "small") policy = PAGES_SMALL;
+    else return false;
+    return true;
+}
 
 template <typename T>
 class CustomMemoryAllocator
@@ -20,9 +73,16 @@ public:
     bool operator==(const CustomMemoryAllocator&) const noexcept { return true; }
     bool operator!=(const CustomMemoryAllocator&) const noexcept { return false; }
 private:
-    static inline bool use_large_pages_ = false;
+    // NOTE: Which blocks came from the large-page path, so each one is freed the way it was
+    // allocated even when the page policy changes in between. Allocations are few and large,
+    // so a locked linear search costs nothing.
+    static inline std::mutex large_page_mutex_;
+    static inline std::vector<void*> large_page_blocks_;
+    static inline AllocatorCounters counters_ = {};
+    static void RememberLargePageBlock(void* p);
+    static bool ForgetLargePageBlock(void* p);
     void* AllocateLargePages(std::size_t size);
-    void DeallocateLargePages(void* p, std::size_t n);
+    bool DeallocateLargePages(void* p, std::size_t n);
     #ifdef _WIN32
     void* AllocateLargePagesWindows(std::size_t size);
     #elif defined(__linux__)
@@ -34,7 +94,10 @@ template <typename T>
 T* CustomMemoryAllocator<T>::allocate(std::size_t n)
 {
     std::size_t size = n * sizeof(T);
-    void* ptr = AllocateLargePages(size);
+    if (!counters_.registered_.load(std::memory_order_acquire)) {
+        RegisterAllocatorCounters(counters_, typeid(T).name());
+    }
+    void* ptr = (g_page_policy == PAGES_HUGE) ? AllocateLargePages(size) : nullptr;
 
     // If large page allocation failed, fallback to normal allocation
     if (!ptr) {
@@ -57,6 +120,19 @@ T* CustomMemoryAllocator<T>::allocate(std::size_t n)
         if (ptr == MAP_FAILED) {
             throw std::bad_alloc();
         }
+        #ifdef MADV_HUGEPAGE
+        if (g_page_policy == PAGES_TRANSPARENT) {
+            madvise(ptr, size, MADV_HUGEPAGE);
+        } else if (g_page_policy == PAGES_SMALL) {
+            madvise(ptr, size, MADV_NOHUGEPAGE);
+        }
+        #endif
+        #endif
+        // NOTE: Windows and Linux asked for large pages first, macOS never does.
+        #if defined(__APPLE__)
+        RecordMap(counters_, size, false, false);
+        #else
+        RecordMap(counters_, size, false, g_page_policy == PAGES_HUGE);
         #endif
     }
 
@@ -67,17 +143,39 @@ template <typename T>
 void CustomMemoryAllocator<T>::deallocate(T* p, std::size_t n)
 {
     std::size_t size = n * sizeof(T);
-    if (use_large_pages_) {
-        DeallocateLargePages(p, size);
+    bool succeeded = true;
+    if (ForgetLargePageBlock(p)) {
+        succeeded = DeallocateLargePages(p, size);
     } else {
         #if defined(__APPLE__)
         free(p);  // Use normal free() on macOS
         #elif defined(__linux__)
-        munmap(p, size);
+        succeeded = munmap(p, size) == 0;
         #elif defined(_WIN32)
         _aligned_free(p);
         #endif
     }
+    RecordUnmap(counters_, size, succeeded);
+}
+
+template <typename T>
+void CustomMemoryAllocator<T>::RememberLargePageBlock(void* p)
+{
+    std::lock_guard<std::mutex> lock(large_page_mutex_);
+    large_page_blocks_.push_back(p);
+}
+
+template <typename T>
+bool CustomMemoryAllocator<T>::ForgetLargePageBlock(void* p)
+{
+    std::lock_guard<std::mutex> lock(large_page_mutex_);
+    auto block = std::find(large_page_blocks_.begin(), large_page_blocks_.end(), p);
+    if (block == large_page_blocks_.end()) {
+        return false;
+    }
+    *block = large_page_blocks_.back();
+    large_page_blocks_.pop_back();
+    return true;
 }
 
 template <typename T>
@@ -93,12 +191,17 @@ void* CustomMemoryAllocator<T>::AllocateLargePages(std::size_t size)
 }
 
 template <typename T>
-void CustomMemoryAllocator<T>::DeallocateLargePages(void* p, std::size_t n)
+bool CustomMemoryAllocator<T>::DeallocateLargePages(void* p, std::size_t n)
 {
     #ifdef _WIN32
-    VirtualFree(p, 0, MEM_RELEASE);
+    return VirtualFree(p, 0, MEM_RELEASE) != 0;
     #elif defined(__linux__)
-    munmap(p, n);
+    // NOTE: MAP_HUGETLB rounds the mapping up to whole huge pages, but munmap rejects a
+    // length that isn't a multiple of one, so round the same way here.
+    std::size_t huge_page_size = LinuxHugePageSize();
+    return munmap(p, (n + huge_page_size - 1) & ~(huge_page_size - 1)) == 0;
+    #else
+    return true;
     #endif
 }
 
@@ -130,7 +233,8 @@ void* CustomMemoryAllocator<T>::AllocateLargePagesWindows(std::size_t size)
 
     void* ptr = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
     if (ptr) {
-        use_large_pages_ = true;
+        RememberLargePageBlock(ptr);
+        RecordMap(counters_, size, true, false);
     }
     return ptr;
 }
@@ -141,13 +245,15 @@ void* CustomMemoryAllocator<T>::AllocateLargePagesLinux(std::size_t size)
     // Try Huge Pages first
     void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
     if (ptr != MAP_FAILED) {
-        use_large_pages_ = true;
+        RememberLargePageBlock(ptr);
+        RecordMap(counters_, size, true, false);
         return ptr;
     }
 
     // Fallback to normal mmap (which may still use Transparent Huge Pages)
     ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
     if (ptr != MAP_FAILED) {
+        RecordMap(counters_, size, false, true);
         return ptr;
     }
 
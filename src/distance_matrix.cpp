@@ -0,0 +1,307 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <string_view>
+#include <vector>
+#include "distance_matrix.hpp"
+#include "haversine_formula.hpp"
+#include "perf_profiler.hpp"
+#include "thread_pool.hpp"
+
+struct MatrixBand
+{
+    uint64_t first_row_;
+    uint64_t row_count_;
+    CustomVector(double) values_;
+    // NOTE: Per (row, job column span), merged in column order once the band is done.
+    std::vector<double> part_min_;
+    std::vector<uint64_t> part_argmin_;
+    std::vector<double> part_sum_;
+};
+
+void ComputeUnitVectors(const CustomVector(Point)& points, bool second_point, UnitVectors& vectors)
+{
+    TimeBandwidth("Unit vectors", points.size() * sizeof(Point));
+    vectors.x_.resize(points.size());
+    vectors.y_.resize(points.size());
+    vectors.z_.resize(points.size());
+    for (uint64_t point_index = 0; point_index < points.size(); ++point_index)
+    {
+        const Point& point = points[point_index];
+        double lat = RadiansFromDegrees(second_point ? point.y1 : point.y0);
+        double lon = RadiansFromDegrees(second_point ? point.x1 : point.x0);
+        double cos_lat = cos(lat);
+        vectors.x_[point_index] = cos_lat * cos(lon);
+        vectors.y_[point_index] = cos_lat * sin(lon);
+        vectors.z_[point_index] = sin(lat);
+    }
+}
+
+// NOTE: One job: rows [row_begin, row_end) of the band against columns [column_begin, column_end),
+// one L1-sized column tile at a time. values is the band's first row, or nullptr to only reduce.
+static void ComputeMatrixTile(const UnitVectors& rows, const UnitVectors& columns, MatrixBand& band, uint64_t row_begin, uint64_t row_end,
+                              uint64_t column_begin, uint64_t column_end, uint64_t part_index, uint64_t part_count, double* values)
+{
+    uint64_t column_count = columns.x_.size();
+    double half_chords[MATRIX_TILE_COLUMNS];
+    for (uint64_t row = row_begin; row < row_end; ++row)
+    {
+        uint64_t part = (row - band.first_row_) * part_count + part_index;
+        band.part_min_[part] = std::numeric_limits<double>::infinity();
+        band.part_argmin_[part] = column_begin;
+        band.part_sum_[part] = 0;
+    }
+
+    for (uint64_t tile_begin = column_begin; tile_begin < column_end; tile_begin += MATRIX_TILE_COLUMNS)
+    {
+        uint64_t tile_count = std::min<uint64_t>(MATRIX_TILE_COLUMNS, column_end - tile_begin);
+        const double* column_x = columns.x_.data() + tile_begin;
+        const double* column_y = columns.y_.data() + tile_begin;
+        const double* column_z = columns.z_.data() + tile_begin;
+        for (uint64_t row = row_begin; row < row_end; ++row)
+        {
+            double row_x = rows.x_[row], row_y = rows.y_[row], row_z = rows.z_[row];
+
+            // NOTE: Split from the asin loop below so the compiler vectorizes it; libm's asin
+            // stays scalar.
+            for (uint64_t column = 0; column < tile_count; ++column)
+            {
+                double dx = row_x - column_x[column];
+                double dy = row_y - column_y[column];
+                double dz = row_z - column_z[column];
+                half_chords[column] = 0.5 * std::sqrt(dx*dx + dy*dy + dz*dz);
+            }
+
+            uint64_t part = (row - band.first_row_) * part_count + part_index;
+            double min = band.part_min_[part];
+            uint64_t argmin = band.part_argmin_[part];
+            double sum = band.part_sum_[part];
+            double* out = values ? values + (row - band.first_row_) * column_count + tile_begin : nullptr;
+            for (uint64_t column = 0; column < tile_count; ++column)
+            {
+                double distance = 2.0 * EARTH_RAD * asin(std::min(half_chords[column], 1.0));
+                if (out) out[column] = distance;
+                sum += distance;
+                if (distance < min)
+                {
+                    min = distance;
+                    argmin = tile_begin + column;
+                }
+            }
+            band.part_min_[part] = min;
+            band.part_argmin_[part] = argmin;
+            band.part_sum_[part] = sum;
+        }
+    }
+}
+
+static void ReduceBand(const MatrixBand& band, uint64_t part_count, MatrixRowReduction& reduction)
+{
+    for (uint64_t band_row = 0; band_row < band.row_count_; ++band_row)
+    {
+        uint64_t row = band.first_row_ + band_row;
+        double min = std::numeric_limits<double>::infinity();
+        uint64_t argmin = 0;
+        double sum = 0;
+        for (uint64_t part_index = 0; part_index < part_count; ++part_index)
+        {
+            uint64_t part = band_row * part_count + part_index;
+            if (band.part_min_[part] < min)
+            {
+                min = band.part_min_[part];
+                argmin = band.part_argmin_[part];
+            }
+            sum += band.part_sum_[part];
+        }
+        reduction.min_[row] = min;
+        reduction.argmin_[row] = argmin;
+        reduction.sum_[row] = sum;
+    }
+}
+
+bool ComputeDistanceMatrix(const UnitVectors& rows, const UnitVectors& columns, const char* matrix_path, MatrixRowReduction& reduction)
+{
+    uint64_t row_count = rows.x_.size();
+    uint64_t column_count = columns.x_.size();
+    reduction.min_.resize(row_count);
+    reduction.argmin_.resize(row_count);
+    reduction.sum_.resize(row_count);
+    if (row_count == 0 || column_count == 0)
+    {
+        return true;
+    }
+
+    FILE* file = nullptr;
+    if (matrix_path)
+    {
+        file = fopen(matrix_path, "wb");
+        MatrixFileHeader header = { MATRIX_FILE_MAGIC, MATRIX_FILE_VERSION, row_count, column_count };
+        if (!file || fwrite(&header, sizeof(header), 1, file) != 1)
+        {
+            std::cerr << "  Could not create matrix file: " << matrix_path << std::endl;
+            if (file) fclose(file);
+            return false;
+        }
+    }
+
+    // NOTE: A band is as many rows as fit MATRIX_BAND_BYTES of output, at least one. Only two
+    // bands exist at a time: workers fill one while this thread writes the other.
+    uint64_t band_rows = std::clamp<uint64_t>(MATRIX_BAND_BYTES / (column_count * sizeof(double)), 1, row_count);
+    if (!file)
+    {
+        band_rows = std::min<uint64_t>(row_count, std::max<uint64_t>(band_rows, MATRIX_TILE_ROWS * GetThreadCount(g_thread_pool) * 4));
+    }
+    uint64_t tile_rows = std::min<uint64_t>(MATRIX_TILE_ROWS, band_rows);
+    uint64_t part_count = (column_count + MATRIX_JOB_COLUMNS - 1) / MATRIX_JOB_COLUMNS;
+    uint64_t band_count = (row_count + band_rows - 1) / band_rows;
+
+    MatrixBand bands[2];
+    for (MatrixBand& band : bands)
+    {
+        if (file) band.values_.resize(band_rows * column_count);
+        band.part_min_.resize(band_rows * part_count);
+        band.part_argmin_.resize(band_rows * part_count);
+        band.part_sum_.resize(band_rows * part_count);
+    }
+
+    auto start_band = [&](uint64_t band_index)
+    {
+        MatrixBand* band = &bands[band_index & 1];
+        band->first_row_ = band_index * band_rows;
+        band->row_count_ = std::min(band_rows, row_count - band->first_row_);
+        uint64_t row_tile_count = (band->row_count_ + tile_rows - 1) / tile_rows;
+        double* values = file ? band->values_.data() : nullptr;
+        RunJobsAsync(g_thread_pool, row_tile_count * part_count, [&, band, values, row_tile_count](uint64_t job_index)
+        {
+            uint64_t row_begin = band->first_row_ + (job_index % row_tile_count) * tile_rows;
+            uint64_t row_end = std::min(row_begin + tile_rows, band->first_row_ + band->row_count_);
+            uint64_t part_index = job_index / row_tile_count;
+            uint64_t column_begin = part_index * MATRIX_JOB_COLUMNS;
+            uint64_t column_end = std::min<uint64_t>(column_begin + MATRIX_JOB_COLUMNS, column_count);
+            ComputeMatrixTile(rows, columns, *band, row_begin, row_end, column_begin, column_end, part_index, part_count, values);
+        });
+    };
+
+    bool written = true;
+    {
+        TimeFlops("Distance matrix", row_count * column_count * sizeof(double), row_count * column_count * MATRIX_NOMINAL_FLOPS);
+        start_band(0);
+        for (uint64_t band_index = 0; band_index < band_count; ++band_index)
+        {
+            WaitForJobs(g_thread_pool);
+            MatrixBand& band = bands[band_index & 1];
+            if (band_index + 1 < band_count)
+            {
+                start_band(band_index + 1);
+            }
+
+            ReduceBand(band, part_count, reduction);
+            if (file)
+            {
+                TimeWriteBandwidth("Write matrix", band.row_count_ * column_count * sizeof(double));
+                uint64_t value_count = band.row_count_ * column_count;
+                written = written && fwrite(band.values_.data(), sizeof(double), value_count, file) == value_count;
+            }
+        }
+    }
+
+    if (file)
+    {
+        written = (fclose(file) == 0) && written;
+        if (!written)
+        {
+            std::cerr << "  Could not write matrix: " << matrix_path << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool LoadMatrixPoints(const char* filename, CustomVector(Point)& points)
+{
+    CustomVector(char) json;
+    uint64_t file_size = ReadPointsJson(filename, json);
+    if (file_size == 0)
+    {
+        return false;
+    }
+    ProcessJson(json.data(), file_size, points, g_config.release_input_);
+    return true;
+}
+
+int RunDistanceMatrix(int argc, char* argv[])
+{
+    const char* row_path = nullptr;
+    const char* column_path = nullptr;
+    const char* matrix_path = nullptr;
+    const char* reduction_path = nullptr;
+    for (int arg_index = 0; arg_index < argc; ++arg_index)
+    {
+        std::string_view arg = argv[arg_index];
+        if (arg == "--output" && arg_index + 1 < argc) matrix_path = argv[++arg_index];
+        else if (arg == "--rows" && arg_index + 1 < argc) reduction_path = argv[++arg_index];
+        else if (!row_path) row_path = argv[arg_index];
+        else column_path = argv[arg_index];
+    }
+    if (!row_path)
+    {
+        std::cerr << "      Usage: matrix <rows.json> [<columns.json>] [--output <matrix.bin>] [--rows <reduction.txt>]" << std::endl;
+        return 1;
+    }
+
+    // NOTE: Rows are the first point of every pair in rows.json, columns the second point of
+    // every pair in columns.json (rows.json again when it isn't given).
+    CustomVector(Point) row_points;
+    CustomVector(Point) column_points;
+    if (!LoadMatrixPoints(row_path, row_points) || (column_path && !LoadMatrixPoints(column_path, column_points)))
+    {
+        return 1;
+    }
+
+    UnitVectors rows, columns;
+    ComputeUnitVectors(row_points, false, rows);
+    ComputeUnitVectors(column_path ? column_points : row_points, true, columns);
+
+    MatrixRowReduction reduction;
+    if (!ComputeDistanceMatrix(rows, columns, matrix_path, reduction))
+    {
+        return 1;
+    }
+
+    long double total = 0;
+    uint64_t min_row = 0;
+    for (uint64_t row = 0; row < reduction.sum_.size(); ++row)
+    {
+        total += reduction.sum_[row];
+        if (reduction.min_[row] < reduction.min_[min_row]) min_row = row;
+    }
+
+    if (reduction_path)
+    {
+        TimeBandwidth("Write row reduction", 0);
+        FILE* file = fopen(reduction_path, "wb");
+        bool written = file != nullptr;
+        for (uint64_t row = 0; written && row < reduction.sum_.size(); ++row)
+        {
+            written = fprintf(file, "%llu %.17g %.17g\n", (unsigned long long)reduction.argmin_[row], reduction.min_[row], reduction.sum_[row]) > 0;
+        }
+        if (file) written = (fclose(file) == 0) && written;
+        if (!written)
+        {
+            std::cerr << "  Could not write row reduction: " << reduction_path << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout << "Matrix: " << rows.x_.size() << " x " << columns.x_.size() << std::endl;
+    std::cout << std::fixed << std::setprecision(16) << "Distance sum: " << total << std::endl;
+    if (!reduction.sum_.empty())
+    {
+        std::cout << "Closest pair: row " << min_row << ", column " << reduction.argmin_[min_row]
+                  << " at " << reduction.min_[min_row] << std::endl;
+    }
+    return 0;
+}
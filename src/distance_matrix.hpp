@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+#include "haversine_processor.hpp"
+#include "haversine_formula.hpp"
+
+#define MATRIX_FILE_MAGIC 0x584D5648 // 'HVMX'
+#define MATRIX_FILE_VERSION 1
+#define MATRIX_TILE_COLUMNS 1024     // 24kb of unit vectors, stays in L1 while a row tile sweeps it
+#define MATRIX_TILE_ROWS 64          // rows per job, each reusing every column tile it loads
+#define MATRIX_JOB_COLUMNS (1 << 16) // fixed, so row sums add up the same way on any thread count
+#define MATRIX_BAND_BYTES (64ull << 20)
+#define MATRIX_NOMINAL_FLOPS (14 + 2 * NOMINAL_FUNCTION_FLOPS) // chord, sqrt, asin and the row reduction, per entry
+
+// NOTE: Points as unit vectors on the sphere, one array per axis so the kernel streams them.
+// The great-circle distance is then 2R*asin(|u - v|/2), the same quantity ReferenceHaversine
+// computes, without any per-pair cos or radian conversion.
+struct UnitVectors
+{
+    CustomVector(double) x_;
+    CustomVector(double) y_;
+    CustomVector(double) z_;
+};
+
+// NOTE: The matrix file is this header followed by row_count_ * column_count_ doubles, row-major.
+struct MatrixFileHeader
+{
+    uint32_t magic_;
+    uint32_t version_;
+    uint64_t row_count_;
+    uint64_t column_count_;
+};
+
+struct MatrixRowReduction
+{
+    CustomVector(double) min_;
+    CustomVector(uint64_t) argmin_;
+    CustomVector(double) sum_;
+};
+
+void ComputeUnitVectors(const CustomVector(Point)& points, bool second_point, UnitVectors& vectors);
+// NOTE: Evaluates every row against every column in cache-sized tiles across the thread pool,
+// reducing each row as it goes. With a matrix_path the values are streamed out band by band,
+// so neither the matrix nor the output ever has to fit in memory.
+bool ComputeDistanceMatrix(const UnitVectors& rows, const UnitVectors& columns, const char* matrix_path, MatrixRowReduction& reduction);
+int RunDistanceMatrix(int argc, char* argv[]);
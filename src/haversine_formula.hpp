@@ -3,6 +3,10 @@
 #include <cmath>
 #include <cstdint>
 #define EARTH_RAD 6372.8
+// NOTE: FLOPs credited to the profiler's roofline report: libm's sin, cos, asin and sqrt
+// count as a nominal 20 each, about one polynomial evaluation, plus the 16 plain operations.
+#define NOMINAL_FUNCTION_FLOPS 20
+#define HAVERSINE_NOMINAL_FLOPS (16 + 6 * NOMINAL_FUNCTION_FLOPS)
 
 double Square(double a);
 double RadiansFromDegrees(double degrees);
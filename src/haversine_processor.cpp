@@ -0,0 +1,279 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string_view>
+#include "haversine_processor.hpp"
+#include "haversine_formula.hpp"
+#include "haversine_stats.hpp"
+#include "json_parser.hpp"
+#include "perf_profiler.hpp"
+#include "thread_pool.hpp"
+
+#if !_WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+ProcessorConfig g_config = { 0, 1 << 16, PARSER_SCHEMA, READ_FREAD, true };
+
+bool ParseReadStrategy(const char* name, ReadStrategy& strategy)
+{
+    std::string_view value = name;
+    if (value == "fread") strategy = READ_FREAD;
+    else if (value == "mmap") strategy = READ_MMAP;
+    else return false;
+    return true;
+}
+
+static const char* AlignPointer(const char* pointer, uint64_t alignment, bool up)
+{
+    uintptr_t address = (uintptr_t)pointer;
+    if (up) address += alignment - 1;
+    return (const char*)(address & ~(uintptr_t)(alignment - 1));
+}
+
+static void PrefetchInputPages(const char* begin, const char* end)
+{
+#if !_WIN32
+    const char* first = AlignPointer(begin, INPUT_RELEASE_ALIGNMENT, false);
+    if (first < end) {
+        madvise(const_cast<char*>(first), end - first, MADV_WILLNEED);
+    }
+#endif
+}
+
+static void ReleaseInputPages(const char* begin, const char* end)
+{
+#if !_WIN32
+    const char* first = AlignPointer(begin, INPUT_RELEASE_ALIGNMENT, true);
+    const char* last = AlignPointer(end, INPUT_RELEASE_ALIGNMENT, false);
+    if (first < last) {
+        madvise(const_cast<char*>(first), last - first, MADV_DONTNEED);
+    }
+#endif
+}
+
+template <typename PointVector>
+static void ProcessJsonAs(const char* data, size_t size, PointVector& points, bool release_input)
+{
+    const char* end = data + size;
+    const char* pos = FindPointsArray(data, end);
+    if (!pos) {
+        return;
+    }
+    if (!release_input) {
+        ParsePointObjects(pos, end, end, points);
+        return;
+    }
+
+    const char* released = data;
+    while (pos < end) {
+        const char* stop = (uint64_t)(end - pos) > INPUT_RELEASE_STEP ? pos + INPUT_RELEASE_STEP : end;
+        PrefetchInputPages(stop, (uint64_t)(end - stop) > INPUT_RELEASE_STEP ? stop + INPUT_RELEASE_STEP : end);
+
+        // NOTE: Resume at the next object, which starts at or after stop; stop at the array's
+        // closing ']' so nothing after the points array is ever taken for a point.
+        const char* parsed = ParsePointObjects(pos, stop, end, points);
+        while (parsed < end && *parsed != '{' && *parsed != ']') ++parsed;
+        if (parsed >= end || *parsed == ']') {
+            ReleaseInputPages(released, parsed);
+            break;
+        }
+        pos = parsed;
+
+        ReleaseInputPages(released, pos);
+        released = std::max(released, AlignPointer(pos, INPUT_RELEASE_ALIGNMENT, false));
+    }
+}
+
+void ProcessJson(const char* data, size_t size, CustomVector(Point)& points, bool release_input)
+{
+    TimeBandwidth(__func__, size);
+    ProcessJsonAs(data, size, points, release_input);
+}
+
+void ProcessJson(const char* data, size_t size, CustomVector(CompactPoint)& points, bool release_input)
+{
+    TimeBandwidth("ProcessJson compact", size);
+    ProcessJsonAs(data, size, points, release_input);
+}
+
+int32_t CompactFromDegrees(double degrees)
+{
+    double units = std::clamp(std::round(degrees * COMPACT_COORDINATE_SCALE), (double)INT32_MIN, (double)INT32_MAX);
+    return (int32_t)units;
+}
+
+static double PairHaversine(const Point& point)
+{
+    return ReferenceHaversine(point.x0, point.y0, point.x1, point.y1, EARTH_RAD);
+}
+
+static double PairHaversine(const CompactPoint& point)
+{
+    // NOTE: Dividing rather than multiplying by 1e-7 gives the double nearest the decimal degrees.
+    return ReferenceHaversine(point.x0 / COMPACT_COORDINATE_SCALE, point.y0 / COMPACT_COORDINATE_SCALE,
+                              point.x1 / COMPACT_COORDINATE_SCALE, point.y1 / COMPACT_COORDINATE_SCALE, EARTH_RAD);
+}
+
+template <typename PointType>
+static void ComputeHaversineChunkAs(const PointType* points, double* haversine_vals, uint64_t point_count, uint64_t chunk_index,
+                                    HaversineStats* chunk_stats)
+{
+    uint64_t begin = chunk_index * g_config.haversine_chunk_size_;
+    uint64_t end = std::min(begin + g_config.haversine_chunk_size_, point_count);
+    for (uint64_t point_index = begin; point_index < end; ++point_index)
+    {
+        haversine_vals[point_index] = PairHaversine(points[point_index]);
+    }
+
+    if (chunk_stats)
+    {
+        AccumulateStats(chunk_stats[chunk_index], haversine_vals, begin, end);
+    }
+}
+
+uint64_t GetHaversineChunkCount(uint64_t point_count)
+{
+    uint64_t chunk_size = g_config.haversine_chunk_size_;
+    return (point_count + chunk_size - 1) / chunk_size;
+}
+
+void ComputeHaversineChunk(const Point* points, double* haversine_vals, uint64_t point_count, uint64_t chunk_index,
+                           HaversineStats* chunk_stats)
+{
+    ComputeHaversineChunkAs(points, haversine_vals, point_count, chunk_index, chunk_stats);
+}
+
+void ComputeHaversineChunk(const CompactPoint* points, double* haversine_vals, uint64_t point_count, uint64_t chunk_index,
+                           HaversineStats* chunk_stats)
+{
+    ComputeHaversineChunkAs(points, haversine_vals, point_count, chunk_index, chunk_stats);
+}
+
+void ComputeHaversine(const Point* points, double* haversine_vals, uint64_t point_count, HaversineStats* chunk_stats)
+{
+    TimeFlops(chunk_stats ? "Haversine+Stats" : "Haversine", point_count * sizeof(Point), point_count * HAVERSINE_NOMINAL_FLOPS);
+    RunJobs(g_thread_pool, GetHaversineChunkCount(point_count), [=](uint64_t chunk_index)
+    {
+        ComputeHaversineChunk(points, haversine_vals, point_count, chunk_index, chunk_stats);
+    });
+}
+
+void ComputeHaversine(const CustomVector(Point)& points, CustomVector(double)& haversine_vals, HaversineStats* chunk_stats)
+{
+    haversine_vals.resize(points.size());
+    ComputeHaversine(points.data(), haversine_vals.data(), points.size(), chunk_stats);
+}
+
+void ComputeHaversine(const CustomVector(CompactPoint)& points, CustomVector(double)& haversine_vals, HaversineStats* chunk_stats)
+{
+    haversine_vals.resize(points.size());
+    const CompactPoint* point_data = points.data();
+    double* val_data = haversine_vals.data();
+    uint64_t point_count = points.size();
+
+    TimeFlops(chunk_stats ? "Haversine compact+Stats" : "Haversine compact", point_count * sizeof(CompactPoint),
+              point_count * HAVERSINE_NOMINAL_FLOPS);
+    RunJobs(g_thread_pool, GetHaversineChunkCount(point_count), [=](uint64_t chunk_index)
+    {
+        ComputeHaversineChunk(point_data, val_data, point_count, chunk_index, chunk_stats);
+    });
+}
+
+double SumHaversine(const double* haversine_vals, uint64_t count)
+{
+    TimeBandwidth(__func__, count * sizeof(double));
+	double sum = 0;
+	for (uint64_t val_index = 0; val_index < count; ++val_index)
+	{
+        sum += haversine_vals[val_index];
+	}
+	return sum;
+}
+
+double SumHaversine(const CustomVector(double)& haversine_vals)
+{
+    return SumHaversine(haversine_vals.data(), haversine_vals.size());
+}
+
+uint64_t ReadPointsJson(const std::string& filename, CustomVector(char)& buffer)
+{
+    TimeFunction;
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (!file) {
+        std::cerr << "  Could not open file: " << filename << std::endl;
+        return 0;
+    }
+
+    fseek(file, 0, SEEK_END);
+    uint64_t file_size = static_cast<uint64_t>(ftell(file));
+    fseek(file, 0, SEEK_SET);
+
+    buffer.reserve(file_size); // allocate exactly
+    {
+        TimeBandwidth("Read file", file_size);
+        size_t read_size = fread(buffer.data(), 1, file_size, file);
+        if (read_size != file_size) {
+            std::cerr << "  Read size mismatch\n";
+            fclose(file);
+            return 0;
+        }
+    }
+
+    fclose(file);
+    return file_size;
+}
+
+bool MapPointsFile(const std::string& filename, MappedFile& file)
+{
+    TimeFunction;
+    file.data_ = nullptr;
+    file.size_ = 0;
+#if _WIN32
+    file.size_ = ReadPointsJson(filename, file.buffer_);
+    file.data_ = file.buffer_.data();
+    return file.size_ != 0;
+#else
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "  Could not open file: " << filename << std::endl;
+        return false;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+        std::cerr << "  Could not stat file or file is empty: " << filename << std::endl;
+        close(fd);
+        return false;
+    }
+
+    void* mapped = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "  Could not map file: " << filename << std::endl;
+        return false;
+    }
+
+    file.data_ = static_cast<const char*>(mapped);
+    file.size_ = static_cast<uint64_t>(file_stat.st_size);
+    return true;
+#endif
+}
+
+void UnmapPointsFile(MappedFile& file)
+{
+#if _WIN32
+    CustomVector(char)().swap(file.buffer_);
+#else
+    if (file.data_) {
+        munmap(const_cast<char*>(file.data_), file.size_);
+    }
+#endif
+    file.data_ = nullptr;
+    file.size_ = 0;
+}
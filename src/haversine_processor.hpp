@@ -0,0 +1,89 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "custom_memory_allocator.hpp"
+
+#define CustomVector(type) std::vector<type, CustomMemoryAllocator<type>>
+
+struct Point
+{
+    double x0;
+    double y0;
+    double x1;
+    double y1;
+};
+
+#define COMPACT_COORDINATE_SCALE 1e7 // units per degree, 1e-7 degrees is about 1.1cm on the ground
+
+// NOTE: A pair in fixed-point degrees, half the size of Point. Any coordinate within
+// [-180, 180] fits an int32 at this scale.
+struct CompactPoint
+{
+    int32_t x0;
+    int32_t y0;
+    int32_t x1;
+    int32_t y1;
+};
+
+// NOTE: A read-only view of a whole input file. On POSIX systems the file is mapped, so
+// pages are only brought in for the parts that are actually touched.
+struct MappedFile
+{
+    const char* data_;
+    uint64_t size_;
+#if _WIN32
+    CustomVector(char) buffer_;
+#endif
+};
+
+enum JsonParser : uint32_t
+{
+    PARSER_GENERIC, // scans and compares every key
+    PARSER_SCHEMA,  // sniffs the object layout once, falls back to generic per object
+};
+
+enum ReadStrategy : uint32_t
+{
+    READ_FREAD, // whole file into an allocated buffer up front
+    READ_MMAP,  // mapped, paged in as the parser reaches it
+};
+
+#define INPUT_RELEASE_STEP (64ull << 20) // bytes parsed between releases of consumed input
+#define INPUT_RELEASE_ALIGNMENT (2ull << 20) // whole huge pages, so hugetlb buffers can be released too
+
+struct ProcessorConfig
+{
+    uint32_t thread_count_;         // 0 = one per hardware thread
+    uint64_t haversine_chunk_size_; // pairs handed to a worker at a time
+    JsonParser parser_;
+    ReadStrategy read_strategy_;
+    bool release_input_;            // hand parsed input pages back to the OS as ProcessJson advances
+};
+
+extern ProcessorConfig g_config;
+
+struct HaversineStats;
+
+uint64_t ReadPointsJson(const std::string& filename, CustomVector(char)& buffer);
+bool MapPointsFile(const std::string& filename, MappedFile& file);
+void UnmapPointsFile(MappedFile& file);
+bool ParseReadStrategy(const char* name, ReadStrategy& strategy);
+// NOTE: With release_input the input is parsed a region at a time: the next region is
+// prefetched and every whole page before the parse position is released, so it reads as
+// zeros (buffer) or is dropped from the resident set (mapping) afterwards.
+void ProcessJson(const char* data, size_t size, CustomVector(Point)& points, bool release_input = false);
+void ProcessJson(const char* data, size_t size, CustomVector(CompactPoint)& points, bool release_input = false);
+int32_t CompactFromDegrees(double degrees);
+uint64_t GetHaversineChunkCount(uint64_t point_count);
+// NOTE: chunk_stats, when given, holds one HaversineStats per chunk, which is filled in while
+// the chunk's distances are still in cache.
+void ComputeHaversineChunk(const Point* points, double* haversine_vals, uint64_t point_count, uint64_t chunk_index,
+                           HaversineStats* chunk_stats = nullptr);
+void ComputeHaversineChunk(const CompactPoint* points, double* haversine_vals, uint64_t point_count, uint64_t chunk_index,
+                           HaversineStats* chunk_stats = nullptr);
+void ComputeHaversine(const Point* points, double* haversine_vals, uint64_t point_count, HaversineStats* chunk_stats = nullptr);
+void ComputeHaversine(const CustomVector(Point)& points, CustomVector(double)& haversine_vals, HaversineStats* chunk_stats = nullptr);
+void ComputeHaversine(const CustomVector(CompactPoint)& points, CustomVector(double)& haversine_vals, HaversineStats* chunk_stats = nullptr);
+double SumHaversine(const double* haversine_vals, uint64_t count);
+double SumHaversine(const CustomVector(double)& haversine_vals);
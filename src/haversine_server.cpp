@@ -0,0 +1,530 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "haversine_server.hpp"
+#include "haversine_processor.hpp"
+#include "perf_profiler.hpp"
+#include "platform_metrics.hpp"
+
+#if _WIN32
+
+int RunServer(const char* socket_path)
+{
+    std::cerr << "Server mode requires Unix domain sockets and is not supported on Windows\n";
+    return 1;
+}
+
+int RunClient(const char* socket_path, int argc, char* argv[])
+{
+    std::cerr << "Server mode requires Unix domain sockets and is not supported on Windows\n";
+    return 1;
+}
+
+#else
+
+#include <atomic>
+#include <climits>
+#include <condition_variable>
+#include <csignal>
+#include <mutex>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// NOTE: A path never needs more than PATH_MAX; 2 GB of inline points is 64M pairs, more than
+// anyone should send over a socket instead of as a file.
+#define MAX_REQUEST_PATH PATH_MAX
+#define MAX_REQUEST_POINTS_PAYLOAD (1ull << 31)
+
+struct ServerState
+{
+    std::mutex compute_mutex_;
+    std::mutex connection_mutex_;
+    std::vector<int> connection_fds_;
+    std::condition_variable connections_done_;
+    uint32_t live_connections_;
+    std::atomic<bool> stopping_;
+    int listen_fd_;
+    uint64_t timer_freq_;
+
+    // NOTE: These stay allocated between requests so a warm server doesn't pay for fresh
+    // mappings and their page faults on every call.
+    CustomVector(char) json_;
+    CustomVector(Point) points_;
+    CustomVector(double) haversine_vals_;
+};
+
+struct ServerConnection
+{
+    int fd_;
+    CustomVector(char) path_;
+    CustomVector(Point) points_;
+    std::string profile_;
+};
+
+static bool ReadExact(int fd, void* dest, uint64_t size)
+{
+    char* at = static_cast<char*>(dest);
+    while (size)
+    {
+        ssize_t got = read(fd, at, size);
+        if (got <= 0)
+        {
+            return false;
+        }
+        at += got;
+        size -= got;
+    }
+    return true;
+}
+
+static bool WriteExact(int fd, const void* src, uint64_t size)
+{
+    const char* at = static_cast<const char*>(src);
+    while (size)
+    {
+        ssize_t sent = write(fd, at, size);
+        if (sent <= 0)
+        {
+            return false;
+        }
+        at += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+static int OpenSocket(const char* socket_path, sockaddr_un& address)
+{
+    if (strlen(socket_path) >= sizeof(address.sun_path))
+    {
+        std::cerr << "Socket path too long: " << socket_path << std::endl;
+        return -1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        perror("socket");
+    }
+    return fd;
+}
+
+static ServerResponseHeader ProcessRequest(ServerState& state, ServerConnection& connection, const ServerRequestHeader& request)
+{
+    ServerResponseHeader response = {};
+    response.magic_ = SERVER_PROTOCOL_MAGIC;
+
+    std::lock_guard<std::mutex> lock(state.compute_mutex_);
+    ResetProfileAnchors();
+    BeginProfile();
+
+    CustomVector(Point)* points = &connection.points_;
+    if (request.type_ == REQUEST_FILE)
+    {
+        std::string filename(connection.path_.data(), connection.path_.size());
+        uint64_t file_size = ReadPointsJson(filename, state.json_);
+        if (file_size == 0)
+        {
+            response.status_ = STATUS_READ_FAILED;
+            return response;
+        }
+
+        state.points_.clear();
+        ProcessJson(state.json_.data(), file_size, state.points_);
+        points = &state.points_;
+    }
+
+    ComputeHaversine(*points, state.haversine_vals_);
+    response.sum_ = SumHaversine(state.haversine_vals_);
+    response.point_count_ = points->size();
+    EndProfile();
+
+    connection.profile_.clear();
+    if (request.flags_ & REQUEST_FLAG_PROFILE)
+    {
+        char* text = nullptr;
+        size_t text_size = 0;
+        FILE* stream = open_memstream(&text, &text_size);
+        if (stream)
+        {
+            PrintProfile(stream, state.timer_freq_);
+            fclose(stream);
+            connection.profile_.assign(text, text_size);
+            free(text);
+        }
+    }
+    response.profile_size_ = connection.profile_.size();
+    return response;
+}
+
+static void StopServer(ServerState& state)
+{
+    state.stopping_ = true;
+    shutdown(state.listen_fd_, SHUT_RDWR);
+
+    std::lock_guard<std::mutex> lock(state.connection_mutex_);
+    for (int fd : state.connection_fds_)
+    {
+        shutdown(fd, SHUT_RDWR);
+    }
+}
+
+static void ServeConnection(ServerState* state, int fd)
+{
+    ServerConnection connection;
+    connection.fd_ = fd;
+
+    ServerRequestHeader request;
+    while (ReadExact(fd, &request, sizeof(request)))
+    {
+        if (request.magic_ != SERVER_PROTOCOL_MAGIC)
+        {
+            std::cerr << "Dropping connection after malformed request\n";
+            break;
+        }
+
+        if (request.type_ == REQUEST_SHUTDOWN)
+        {
+            StopServer(*state);
+            break;
+        }
+
+        ServerResponseHeader response = {};
+        response.magic_ = SERVER_PROTOCOL_MAGIC;
+        response.status_ = STATUS_BAD_REQUEST;
+
+        bool valid_size = (request.type_ == REQUEST_FILE && request.payload_size_ < MAX_REQUEST_PATH) ||
+                          (request.type_ == REQUEST_POINTS && request.payload_size_ <= MAX_REQUEST_POINTS_PAYLOAD &&
+                           (request.payload_size_ % sizeof(Point)) == 0);
+        if (!valid_size)
+        {
+            std::cerr << "Dropping connection after request of type " << request.type_ << " with "
+                      << request.payload_size_ << " payload bytes" << std::endl;
+            WriteExact(fd, &response, sizeof(response));
+            break;
+        }
+
+        // NOTE: The payload is never read without somewhere to put it, so the connection can't be
+        // kept in sync after a failed allocation; answer and drop it rather than take the daemon down.
+        bool payload_read = false;
+        try
+        {
+            if (request.type_ == REQUEST_FILE)
+            {
+                connection.path_.resize(request.payload_size_);
+                payload_read = ReadExact(fd, connection.path_.data(), request.payload_size_);
+            }
+            else
+            {
+                connection.points_.resize(request.payload_size_ / sizeof(Point));
+                payload_read = ReadExact(fd, connection.points_.data(), request.payload_size_);
+            }
+        }
+        catch (const std::bad_alloc&)
+        {
+            std::cerr << "Dropping connection, could not allocate " << request.payload_size_ << " payload bytes" << std::endl;
+            WriteExact(fd, &response, sizeof(response));
+            break;
+        }
+
+        if (!payload_read)
+        {
+            break;
+        }
+
+        response = ProcessRequest(*state, connection, request);
+        if (!WriteExact(fd, &response, sizeof(response)) ||
+            !WriteExact(fd, connection.profile_.data(), connection.profile_.size()))
+        {
+            break;
+        }
+    }
+
+    // NOTE: Connection threads are detached, so this is the last touch of state; RunServer
+    // can't return before the count it waits on drops to zero under the same lock.
+    std::lock_guard<std::mutex> lock(state->connection_mutex_);
+    auto& fds = state->connection_fds_;
+    fds.erase(std::remove(fds.begin(), fds.end(), fd), fds.end());
+    close(fd);
+    --state->live_connections_;
+    state->connections_done_.notify_all();
+}
+
+int RunServer(const char* socket_path)
+{
+    signal(SIGPIPE, SIG_IGN);
+
+    sockaddr_un address;
+    ServerState state;
+    state.stopping_ = false;
+    state.live_connections_ = 0;
+    state.listen_fd_ = OpenSocket(socket_path, address);
+    if (state.listen_fd_ < 0)
+    {
+        return 1;
+    }
+
+    unlink(socket_path);
+    if (bind(state.listen_fd_, (sockaddr*)&address, sizeof(address)) != 0 || listen(state.listen_fd_, 64) != 0)
+    {
+        perror("bind/listen");
+        close(state.listen_fd_);
+        return 1;
+    }
+
+    // NOTE: Calibrate once up front so individual requests never pay for it.
+    state.timer_freq_ = EstimateBlockTimerFreq();
+    std::cout << "Listening on " << socket_path << std::endl;
+
+    while (!state.stopping_)
+    {
+        int fd = accept(state.listen_fd_, nullptr, nullptr);
+        if (fd < 0)
+        {
+            if (state.stopping_)
+            {
+                break;
+            }
+            perror("accept");
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(state.connection_mutex_);
+            state.connection_fds_.push_back(fd);
+            ++state.live_connections_;
+        }
+        std::thread(ServeConnection, &state, fd).detach();
+    }
+
+    StopServer(state);
+    {
+        std::unique_lock<std::mutex> lock(state.connection_mutex_);
+        state.connections_done_.wait(lock, [&] { return state.live_connections_ == 0; });
+    }
+
+    close(state.listen_fd_);
+    unlink(socket_path);
+    return 0;
+}
+
+struct ClientOptions
+{
+    const char* filename_;
+    uint64_t request_count_;
+    uint32_t connection_count_;
+    bool send_inline_;
+    bool request_profile_;
+    bool shutdown_;
+};
+
+struct ClientConnectionResults
+{
+    std::vector<uint64_t> latencies_;
+    ServerResponseHeader last_response_;
+    std::string last_profile_;
+    bool failed_;
+};
+
+static int ConnectToServer(const char* socket_path)
+{
+    sockaddr_un address;
+    int fd = OpenSocket(socket_path, address);
+    if (fd >= 0 && connect(fd, (sockaddr*)&address, sizeof(address)) != 0)
+    {
+        perror("connect");
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+static void RunClientConnection(const char* socket_path, const ClientOptions* options, const CustomVector(Point)* points, ClientConnectionResults* results)
+{
+    results->failed_ = true;
+    int fd = ConnectToServer(socket_path);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    ServerRequestHeader request = {};
+    request.magic_ = SERVER_PROTOCOL_MAGIC;
+    request.flags_ = options->request_profile_ ? (uint32_t)REQUEST_FLAG_PROFILE : 0u;
+    const void* payload;
+    if (options->send_inline_)
+    {
+        request.type_ = REQUEST_POINTS;
+        request.payload_size_ = points->size() * sizeof(Point);
+        payload = points->data();
+    }
+    else
+    {
+        request.type_ = REQUEST_FILE;
+        request.payload_size_ = strlen(options->filename_);
+        payload = options->filename_;
+    }
+
+    results->latencies_.reserve(options->request_count_);
+    for (uint64_t request_index = 0; request_index < options->request_count_; ++request_index)
+    {
+        uint64_t start = ReadOSTimer();
+        ServerResponseHeader& response = results->last_response_;
+        if (!WriteExact(fd, &request, sizeof(request)) ||
+            !WriteExact(fd, payload, request.payload_size_) ||
+            !ReadExact(fd, &response, sizeof(response)))
+        {
+            std::cerr << "Connection to server lost\n";
+            close(fd);
+            return;
+        }
+
+        results->last_profile_.resize(response.profile_size_);
+        if (!ReadExact(fd, results->last_profile_.data(), response.profile_size_))
+        {
+            close(fd);
+            return;
+        }
+        results->latencies_.push_back(ReadOSTimer() - start);
+
+        if (response.status_ != STATUS_OK)
+        {
+            std::cerr << "Server returned status " << response.status_ << std::endl;
+            close(fd);
+            return;
+        }
+    }
+
+    results->failed_ = false;
+    close(fd);
+}
+
+static int SendShutdown(const char* socket_path)
+{
+    int fd = ConnectToServer(socket_path);
+    if (fd < 0)
+    {
+        return 1;
+    }
+
+    ServerRequestHeader request = {};
+    request.magic_ = SERVER_PROTOCOL_MAGIC;
+    request.type_ = REQUEST_SHUTDOWN;
+    bool sent = WriteExact(fd, &request, sizeof(request));
+    close(fd);
+    return sent ? 0 : 1;
+}
+
+int RunClient(const char* socket_path, int argc, char* argv[])
+{
+    ClientOptions options = {};
+    options.request_count_ = 100;
+    options.connection_count_ = 1;
+    for (int arg_index = 0; arg_index < argc; ++arg_index)
+    {
+        std::string_view arg = argv[arg_index];
+        if (arg == "--requests" && arg_index + 1 < argc) options.request_count_ = strtoull(argv[++arg_index], nullptr, 10);
+        else if (arg == "--connections" && arg_index + 1 < argc) options.connection_count_ = (uint32_t)strtoul(argv[++arg_index], nullptr, 10);
+        else if (arg == "--inline") options.send_inline_ = true;
+        else if (arg == "--profile") options.request_profile_ = true;
+        else if (arg == "--shutdown") options.shutdown_ = true;
+        else options.filename_ = argv[arg_index];
+    }
+
+    if (options.shutdown_)
+    {
+        return SendShutdown(socket_path);
+    }
+
+    if (!options.filename_ || options.connection_count_ == 0 || options.request_count_ == 0)
+    {
+        std::cerr << "      Usage: client <socket> <filename.json> [--requests N] [--connections N] [--inline] [--profile] [--shutdown]" << std::endl;
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    // NOTE: The server resolves file requests itself, so hand it an absolute path.
+    std::string filename = options.filename_;
+    char* resolved = realpath(options.filename_, nullptr);
+    if (resolved)
+    {
+        filename = resolved;
+        free(resolved);
+    }
+    options.filename_ = filename.c_str();
+
+    CustomVector(Point) points;
+    if (options.send_inline_)
+    {
+        CustomVector(char) json;
+        uint64_t file_size = ReadPointsJson(filename, json);
+        if (file_size == 0)
+        {
+            return 1;
+        }
+        ProcessJson(json.data(), file_size, points);
+    }
+
+    std::vector<ClientConnectionResults> results(options.connection_count_);
+    std::vector<std::thread> connections;
+    uint64_t start = ReadOSTimer();
+    for (uint32_t connection_index = 0; connection_index < options.connection_count_; ++connection_index)
+    {
+        connections.emplace_back(RunClientConnection, socket_path, &options, &points, &results[connection_index]);
+    }
+    for (auto& connection : connections)
+    {
+        connection.join();
+    }
+    uint64_t elapsed = ReadOSTimer() - start;
+
+    std::vector<uint64_t> latencies;
+    for (auto& result : results)
+    {
+        if (result.failed_)
+        {
+            return 1;
+        }
+        latencies.insert(latencies.end(), result.latencies_.begin(), result.latencies_.end());
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    double os_freq = (double)GetOSTimerFreq();
+    double total_latency = 0;
+    for (uint64_t latency : latencies)
+    {
+        total_latency += (double)latency;
+    }
+    auto LatencyMs = [&](double latency) { return 1000.0 * latency / os_freq; };
+    auto Percentile = [&](double fraction) { return (double)latencies[(size_t)(fraction * (double)(latencies.size() - 1))]; };
+
+    const ServerResponseHeader& last = results.back().last_response_;
+    std::cout << "Points: " << last.point_count_ << std::endl;
+    std::cout << std::fixed << std::setprecision(16) << "Haversine sum: " << last.sum_ << std::endl;
+    printf("\n%llu requests over %u connections in %.4fs (%.2f req/s)\n",
+           (unsigned long long)latencies.size(), options.connection_count_, (double)elapsed / os_freq,
+           (double)latencies.size() * os_freq / (double)elapsed);
+    printf("  Latency min %.4fms avg %.4fms p50 %.4fms p99 %.4fms max %.4fms\n",
+           LatencyMs((double)latencies.front()), LatencyMs(total_latency / (double)latencies.size()),
+           LatencyMs(Percentile(0.50)), LatencyMs(Percentile(0.99)), LatencyMs((double)latencies.back()));
+
+    if (options.request_profile_)
+    {
+        printf("\nLast server profile:%s", results.back().last_profile_.c_str());
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+
+#define SERVER_PROTOCOL_MAGIC 0x52535648 // 'HVSR'
+
+enum ServerRequestType : uint32_t
+{
+    REQUEST_FILE = 1,     // payload is a path to a points JSON file readable by the server
+    REQUEST_POINTS = 2,   // payload is a packed array of Point
+    REQUEST_SHUTDOWN = 3, // no payload, server exits once the current request finishes
+};
+
+enum ServerRequestFlags : uint32_t
+{
+    REQUEST_FLAG_PROFILE = 1, // return the profiler report for this request
+};
+
+enum ServerStatus : uint32_t
+{
+    STATUS_OK = 0,
+    STATUS_BAD_REQUEST = 1,
+    STATUS_READ_FAILED = 2,
+};
+
+struct ServerRequestHeader
+{
+    uint32_t magic_;
+    uint32_t type_;
+    uint32_t flags_;
+    uint32_t reserved_;
+    uint64_t payload_size_;
+};
+
+struct ServerResponseHeader
+{
+    uint32_t magic_;
+    uint32_t status_;
+    uint64_t point_count_;
+    double sum_;
+    uint64_t profile_size_; // bytes of profiler text following the header
+};
+
+int RunServer(const char* socket_path);
+int RunClient(const char* socket_path, int argc, char* argv[]);
@@ -0,0 +1,230 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include "haversine_stats.hpp"
+#include "haversine_formula.hpp"
+#include "perf_profiler.hpp"
+
+#define STATS_LANES 8
+
+// NOTE: Nothing on the sphere is further apart than half its circumference.
+static constexpr double MAX_DISTANCE = 3.14159265358979323846 * EARTH_RAD;
+
+static bool RanksBelow(const RankedDistance& a, const RankedDistance& b)
+{
+    // NOTE: Builds a min-heap with std heap functions; ties keep the earlier pair.
+    return a.distance_ > b.distance_ || (a.distance_ == b.distance_ && a.pair_index_ < b.pair_index_);
+}
+
+static void OfferTop(HaversineStats& stats, RankedDistance candidate)
+{
+    if (stats.top_.size() < stats.top_count_)
+    {
+        stats.top_.push_back(candidate);
+        std::push_heap(stats.top_.begin(), stats.top_.end(), RanksBelow);
+    }
+    else if (stats.top_count_ && RanksBelow(candidate, stats.top_.front()))
+    {
+        std::pop_heap(stats.top_.begin(), stats.top_.end(), RanksBelow);
+        stats.top_.back() = candidate;
+        std::push_heap(stats.top_.begin(), stats.top_.end(), RanksBelow);
+    }
+}
+
+static uint32_t SketchBucket(double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    int64_t exponent = (int64_t)((bits >> 52) & 0x7FF) - 1023;
+    if (value <= 0 || exponent < SKETCH_MIN_EXPONENT)
+    {
+        return 0;
+    }
+    if (exponent >= SKETCH_MAX_EXPONENT)
+    {
+        return SKETCH_BUCKET_COUNT - 1;
+    }
+
+    uint64_t mantissa = (bits >> (52 - SKETCH_MANTISSA_BITS)) & ((1u << SKETCH_MANTISSA_BITS) - 1);
+    return 1 + (uint32_t)(((exponent - SKETCH_MIN_EXPONENT) << SKETCH_MANTISSA_BITS) | mantissa);
+}
+
+static double SketchBucketMidpoint(uint32_t bucket)
+{
+    if (bucket == 0)
+    {
+        return 0;
+    }
+
+    uint32_t packed = bucket - 1;
+    int exponent = (int)(packed >> SKETCH_MANTISSA_BITS) + SKETCH_MIN_EXPONENT;
+    double mantissa = 1.0 + ((double)(packed & ((1u << SKETCH_MANTISSA_BITS) - 1)) + 0.5) / (double)(1u << SKETCH_MANTISSA_BITS);
+    return std::ldexp(mantissa, exponent);
+}
+
+void InitializeStats(HaversineStats& stats, uint32_t top_count)
+{
+    stats.count_ = 0;
+    stats.min_ = std::numeric_limits<double>::infinity();
+    stats.max_ = -std::numeric_limits<double>::infinity();
+    stats.sum_ = 0;
+    memset(stats.histogram_, 0, sizeof(stats.histogram_));
+    memset(stats.sketch_, 0, sizeof(stats.sketch_));
+    stats.top_count_ = top_count;
+    stats.top_.clear();
+    stats.top_.reserve(top_count);
+}
+
+void AccumulateStats(HaversineStats& stats, const double* haversine_vals, uint64_t begin, uint64_t end)
+{
+    // NOTE: Min/max/sum run in independent lanes so the compiler can keep them in vector
+    // registers; the bucket updates are scatters and get their own loop over the same,
+    // still cache-resident, values.
+    double lane_min[STATS_LANES];
+    double lane_max[STATS_LANES];
+    double lane_sum[STATS_LANES];
+    for (uint32_t lane = 0; lane < STATS_LANES; ++lane)
+    {
+        lane_min[lane] = stats.min_;
+        lane_max[lane] = stats.max_;
+        lane_sum[lane] = 0;
+    }
+
+    uint64_t index = begin;
+    for (; index + STATS_LANES <= end; index += STATS_LANES)
+    {
+        for (uint32_t lane = 0; lane < STATS_LANES; ++lane)
+        {
+            double value = haversine_vals[index + lane];
+            lane_min[lane] = value < lane_min[lane] ? value : lane_min[lane];
+            lane_max[lane] = value > lane_max[lane] ? value : lane_max[lane];
+            lane_sum[lane] += value;
+        }
+    }
+    for (; index < end; ++index)
+    {
+        double value = haversine_vals[index];
+        lane_min[0] = std::min(lane_min[0], value);
+        lane_max[0] = std::max(lane_max[0], value);
+        lane_sum[0] += value;
+    }
+
+    for (uint32_t lane = 0; lane < STATS_LANES; ++lane)
+    {
+        stats.min_ = std::min(stats.min_, lane_min[lane]);
+        stats.max_ = std::max(stats.max_, lane_max[lane]);
+        stats.sum_ += lane_sum[lane];
+    }
+    stats.count_ += end - begin;
+
+    double histogram_scale = (double)STATS_HISTOGRAM_BUCKETS / MAX_DISTANCE;
+    for (index = begin; index < end; ++index)
+    {
+        double value = haversine_vals[index];
+        // NOTE: Clamped before the cast, which is undefined out of range; NaN from malformed
+        // coordinates lands in the top bucket, as it does in the sketch.
+        double scaled = value * histogram_scale;
+        double last_bucket = STATS_HISTOGRAM_BUCKETS - 1.0;
+        uint32_t histogram_bucket = (uint32_t)(std::isnan(scaled) ? last_bucket : std::clamp(scaled, 0.0, last_bucket));
+        ++stats.histogram_[histogram_bucket];
+        ++stats.sketch_[SketchBucket(value)];
+
+        if (stats.top_count_ && (stats.top_.size() < stats.top_count_ || value >= stats.top_.front().distance_))
+        {
+            OfferTop(stats, { value, index });
+        }
+    }
+}
+
+void MergeStats(HaversineStats& into, const HaversineStats& from)
+{
+    into.count_ += from.count_;
+    into.min_ = std::min(into.min_, from.min_);
+    into.max_ = std::max(into.max_, from.max_);
+    into.sum_ += from.sum_;
+    for (uint32_t bucket = 0; bucket < STATS_HISTOGRAM_BUCKETS; ++bucket)
+    {
+        into.histogram_[bucket] += from.histogram_[bucket];
+    }
+    for (uint32_t bucket = 0; bucket < SKETCH_BUCKET_COUNT; ++bucket)
+    {
+        into.sketch_[bucket] += from.sketch_[bucket];
+    }
+    for (const RankedDistance& candidate : from.top_)
+    {
+        OfferTop(into, candidate);
+    }
+}
+
+HaversineStats MergeChunkStats(const std::vector<HaversineStats>& chunk_stats, uint32_t top_count)
+{
+    TimeBandwidth("Merge statistics", chunk_stats.size() * sizeof(HaversineStats));
+    HaversineStats result;
+    InitializeStats(result, top_count);
+    for (const HaversineStats& stats : chunk_stats)
+    {
+        MergeStats(result, stats);
+    }
+    return result;
+}
+
+double EstimateQuantile(const HaversineStats& stats, double fraction)
+{
+    if (stats.count_ == 0)
+    {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)(fraction * (double)(stats.count_ - 1));
+    uint64_t seen = 0;
+    for (uint32_t bucket = 0; bucket < SKETCH_BUCKET_COUNT; ++bucket)
+    {
+        seen += stats.sketch_[bucket];
+        if (seen > rank)
+        {
+            return std::clamp(SketchBucketMidpoint(bucket), stats.min_, stats.max_);
+        }
+    }
+    return stats.max_;
+}
+
+void PrintStats(FILE* out, const HaversineStats& stats)
+{
+    if (stats.count_ == 0)
+    {
+        fprintf(out, "\nDistance stats: no pairs\n");
+        return;
+    }
+
+    fprintf(out, "\nDistance stats: min %.4f max %.4f mean %.4f\n", stats.min_, stats.max_, stats.sum_ / (double)stats.count_);
+
+    static const double quantiles[] = { 0.01, 0.10, 0.25, 0.50, 0.75, 0.90, 0.99, 0.999 };
+    fprintf(out, "  Quantiles (within %.2f%%):", 100.0 / (double)(1u << (SKETCH_MANTISSA_BITS + 1)));
+    for (double fraction : quantiles)
+    {
+        fprintf(out, " p%g %.2f", 100.0 * fraction, EstimateQuantile(stats, fraction));
+    }
+    fprintf(out, "\n");
+
+    uint64_t largest_bucket = *std::max_element(stats.histogram_, stats.histogram_ + STATS_HISTOGRAM_BUCKETS);
+    double bucket_width = MAX_DISTANCE / STATS_HISTOGRAM_BUCKETS;
+    fprintf(out, "  Histogram:\n");
+    for (uint32_t bucket = 0; bucket < STATS_HISTOGRAM_BUCKETS; ++bucket)
+    {
+        int bar_length = largest_bucket ? (int)(40 * stats.histogram_[bucket] / largest_bucket) : 0;
+        fprintf(out, "    [%8.1f, %8.1f) %10llu %.*s\n", bucket * bucket_width, (bucket + 1) * bucket_width,
+                (unsigned long long)stats.histogram_[bucket], bar_length, "########################################");
+    }
+
+    std::vector<RankedDistance> top = stats.top_;
+    std::sort_heap(top.begin(), top.end(), RanksBelow);
+    if (!top.empty())
+    {
+        fprintf(out, "  Longest %zu pairs:\n", top.size());
+    }
+    for (const RankedDistance& ranked : top)
+    {
+        fprintf(out, "    #%llu %.4f\n", (unsigned long long)ranked.pair_index_, ranked.distance_);
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// NOTE: Log-linear buckets: the double's exponent plus the top SKETCH_MANTISSA_BITS of its
+// mantissa, which bounds the relative error of any quantile to 2^-SKETCH_MANTISSA_BITS
+// without a log() per value. Values below 2^SKETCH_MIN_EXPONENT km (~1mm) share bucket 0.
+#define SKETCH_MANTISSA_BITS 7
+#define SKETCH_MIN_EXPONENT -20
+#define SKETCH_MAX_EXPONENT 15
+#define SKETCH_BUCKET_COUNT (((SKETCH_MAX_EXPONENT - SKETCH_MIN_EXPONENT) << SKETCH_MANTISSA_BITS) + 1)
+
+#define STATS_HISTOGRAM_BUCKETS 20
+
+struct RankedDistance
+{
+    double distance_;
+    uint64_t pair_index_;
+};
+
+struct HaversineStats
+{
+    uint64_t count_;
+    double min_;
+    double max_;
+    double sum_;
+    uint64_t histogram_[STATS_HISTOGRAM_BUCKETS];
+    uint64_t sketch_[SKETCH_BUCKET_COUNT];
+
+    uint32_t top_count_;
+    std::vector<RankedDistance> top_; // min-heap on distance_, at most top_count_ entries
+};
+
+void InitializeStats(HaversineStats& stats, uint32_t top_count);
+void AccumulateStats(HaversineStats& stats, const double* haversine_vals, uint64_t begin, uint64_t end);
+void MergeStats(HaversineStats& into, const HaversineStats& from);
+HaversineStats MergeChunkStats(const std::vector<HaversineStats>& chunk_stats, uint32_t top_count);
+double EstimateQuantile(const HaversineStats& stats, double fraction);
+void PrintStats(FILE* out, const HaversineStats& stats);
@@ -0,0 +1,293 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <vector>
+#include "incremental_cache.hpp"
+#include "haversine_processor.hpp"
+#include "json_parser.hpp"
+#include "perf_profiler.hpp"
+#include "thread_pool.hpp"
+
+static uint64_t RotateLeft(uint64_t value, int shift)
+{
+    return (value << shift) | (value >> (64 - shift));
+}
+
+static uint64_t MixWord(uint64_t lane, uint64_t word)
+{
+    lane += word * 0xC2B2AE3D27D4EB4Full;
+    lane = RotateLeft(lane, 31);
+    return lane * 0x9E3779B185EBCA87ull;
+}
+
+uint64_t HashBytes(const char* data, uint64_t size)
+{
+    // NOTE: Four independent lanes so hashing runs near memory speed; this only has to
+    // catch edits to a file we parsed before, not resist anyone crafting collisions.
+    uint64_t lanes[4] = { 0x9E3779B185EBCA87ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull, 0x27D4EB2F165667C5ull };
+    uint64_t index = 0;
+    for (; index + 32 <= size; index += 32)
+    {
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            uint64_t word;
+            memcpy(&word, data + index + 8*lane, sizeof(word));
+            lanes[lane] = MixWord(lanes[lane], word);
+        }
+    }
+
+    uint64_t hash = size;
+    for (int lane = 0; lane < 4; ++lane)
+    {
+        hash = MixWord(hash, lanes[lane]);
+    }
+
+    uint64_t tail = 0;
+    for (uint64_t tail_index = 0; index < size; ++index, ++tail_index)
+    {
+        tail |= (uint64_t)(unsigned char)data[index] << (8 * (tail_index & 7));
+        if ((tail_index & 7) == 7 || index + 1 == size)
+        {
+            hash = MixWord(hash, tail);
+            tail = 0;
+        }
+    }
+
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static int64_t GetFileMtime(const std::string& path)
+{
+    std::error_code error;
+    auto mtime = std::filesystem::last_write_time(path, error);
+    return error ? 0 : (int64_t)mtime.time_since_epoch().count();
+}
+
+static std::vector<CachedChunk> LoadIncrementalCache(const std::string& cache_path, uint64_t array_offset, uint64_t prefix_hash,
+                                                     IncrementalCacheHeader& header)
+{
+    std::vector<CachedChunk> chunks;
+    FILE* file = fopen(cache_path.c_str(), "rb");
+    if (!file)
+    {
+        return chunks;
+    }
+
+    if (fread(&header, sizeof(header), 1, file) == 1 &&
+        header.magic_ == INCREMENTAL_CACHE_MAGIC && header.version_ == INCREMENTAL_CACHE_VERSION &&
+        header.array_offset_ == array_offset && header.prefix_hash_ == prefix_hash)
+    {
+        chunks.resize(header.chunk_count_);
+        if (fread(chunks.data(), sizeof(CachedChunk), chunks.size(), file) != chunks.size())
+        {
+            chunks.clear();
+        }
+    }
+    if (chunks.empty())
+    {
+        header = {};
+    }
+
+    fclose(file);
+    return chunks;
+}
+
+static void SaveIncrementalCache(const std::string& cache_path, const IncrementalCacheHeader& cache_header, const std::vector<CachedChunk>& chunks)
+{
+    IncrementalCacheHeader header = cache_header;
+    header.magic_ = INCREMENTAL_CACHE_MAGIC;
+    header.version_ = INCREMENTAL_CACHE_VERSION;
+    header.chunk_count_ = chunks.size();
+
+    std::string temp_path = cache_path + ".tmp";
+    FILE* file = fopen(temp_path.c_str(), "wb");
+    bool written = file &&
+                   fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   fwrite(chunks.data(), sizeof(CachedChunk), chunks.size(), file) == chunks.size();
+    if (file)
+    {
+        written = (fclose(file) == 0) && written;
+    }
+
+    if (!written || rename(temp_path.c_str(), cache_path.c_str()) != 0)
+    {
+        std::cerr << "  Could not write incremental cache: " << cache_path << std::endl;
+        remove(temp_path.c_str());
+    }
+}
+
+// NOTE: Only an unbroken run from the start of the array is usable, since a chunk's sum says
+// nothing about whether the bytes before it still parse the same way. Returns how many of the
+// leading chunks line up end to end inside the file, without looking at their bytes.
+static uint64_t CountContiguousChunks(uint64_t array_offset, uint64_t size, const std::vector<CachedChunk>& chunks)
+{
+    uint64_t valid_count = 0;
+    uint64_t expected_begin = array_offset;
+    while (valid_count < chunks.size() && chunks[valid_count].begin_ == expected_begin &&
+           chunks[valid_count].begin_ <= chunks[valid_count].end_ && chunks[valid_count].end_ <= size)
+    {
+        expected_begin = chunks[valid_count].end_;
+        ++valid_count;
+    }
+    return valid_count;
+}
+
+static uint64_t VerifyCachedChunks(const char* data, const std::vector<CachedChunk>& chunks, uint64_t& hashed_byte_count)
+{
+    uint64_t byte_count = 0;
+    for (const CachedChunk& chunk : chunks)
+    {
+        byte_count += chunk.end_ - chunk.begin_;
+    }
+    hashed_byte_count += byte_count;
+    TimeBandwidth("Verify cached chunks", byte_count);
+
+    std::vector<char> matches(chunks.size(), 0);
+    RunJobs(g_thread_pool, chunks.size(), [&](uint64_t chunk_index)
+    {
+        const CachedChunk& chunk = chunks[chunk_index];
+        matches[chunk_index] = HashBytes(data + chunk.begin_, chunk.end_ - chunk.begin_) == chunk.hash_;
+    });
+
+    uint64_t valid_count = 0;
+    while (valid_count < chunks.size() && matches[valid_count])
+    {
+        ++valid_count;
+    }
+    return valid_count;
+}
+
+// NOTE: Appending only rewrites what follows the last cached '}', so a file that is unchanged
+// by size and mtime is trusted as is, and one that grew is trusted once its last cached chunk
+// still matches. Anything else (shrunk, rewritten in place, a stale last chunk) falls back to
+// re-hashing every chunk to find how much of the prefix survived.
+static uint64_t CheckCachedChunks(const char* data, uint64_t size, int64_t mtime, const IncrementalCacheHeader& header,
+                                  const std::vector<CachedChunk>& chunks, bool verify_all, uint64_t& hashed_byte_count)
+{
+    if (chunks.empty() || verify_all)
+    {
+        return VerifyCachedChunks(data, chunks, hashed_byte_count);
+    }
+
+    if (size == header.file_size_ && mtime == header.file_mtime_)
+    {
+        return chunks.size();
+    }
+
+    if (size > header.file_size_)
+    {
+        const CachedChunk& last = chunks.back();
+        hashed_byte_count += last.end_ - last.begin_;
+        TimeBandwidth("Verify last cached chunk", last.end_ - last.begin_);
+        if (HashBytes(data + last.begin_, last.end_ - last.begin_) == last.hash_)
+        {
+            return chunks.size();
+        }
+    }
+
+    return VerifyCachedChunks(data, chunks, hashed_byte_count);
+}
+
+bool ProcessIncremental(const std::string& filename, bool verify_all, IncrementalResult& result)
+{
+    result = {};
+
+    MappedFile file;
+    if (!MapPointsFile(filename, file))
+    {
+        return false;
+    }
+
+    const char* data = file.data_;
+    const char* end = data + file.size_;
+    const char* array = FindPointsArray(data, end);
+    if (!array)
+    {
+        UnmapPointsFile(file);
+        return false;
+    }
+
+    uint64_t array_offset = array - data;
+    uint64_t prefix_hash = HashBytes(data, array_offset);
+    std::string cache_path = filename + INCREMENTAL_CACHE_SUFFIX;
+
+    int64_t file_mtime = GetFileMtime(filename);
+    IncrementalCacheHeader header = {};
+    std::vector<CachedChunk> chunks = LoadIncrementalCache(cache_path, array_offset, prefix_hash, header);
+    chunks.resize(CountContiguousChunks(array_offset, file.size_, chunks));
+    chunks.resize(CheckCachedChunks(data, file.size_, file_mtime, header, chunks, verify_all, result.hashed_byte_count_));
+    result.reused_chunk_count_ = chunks.size();
+
+    const char* tail = chunks.empty() ? array : data + chunks.back().end_;
+    result.reused_byte_count_ = tail - array;
+    result.parsed_byte_count_ = end - tail;
+
+    CustomVector(Point) points;
+    uint64_t first_new_chunk = chunks.size();
+    {
+        TimeBandwidth("ProcessJson tail", end - tail);
+        const char* pos = tail;
+        for (;;)
+        {
+            uint64_t first_point = points.size();
+            const char* stop = (uint64_t)(end - pos) > INCREMENTAL_CHUNK_BYTES ? pos + INCREMENTAL_CHUNK_BYTES : end;
+            const char* chunk_end = ParsePointObjects(pos, stop, end, points);
+            if (chunk_end == pos)
+            {
+                break;
+            }
+
+            CachedChunk chunk = {};
+            chunk.begin_ = pos - data;
+            chunk.end_ = chunk_end - data;
+            chunk.hash_ = HashBytes(pos, chunk_end - pos);
+            chunk.point_count_ = points.size() - first_point;
+            chunks.push_back(chunk);
+            pos = chunk_end;
+        }
+    }
+
+    CustomVector(double) haversine_vals;
+    ComputeHaversine(points, haversine_vals);
+    {
+        TimeBandwidth("Sum new chunks", haversine_vals.size() * sizeof(double));
+        const double* val = haversine_vals.data();
+        for (uint64_t chunk_index = first_new_chunk; chunk_index < chunks.size(); ++chunk_index)
+        {
+            CachedChunk& chunk = chunks[chunk_index];
+            double sum = 0;
+            for (uint64_t point_index = 0; point_index < chunk.point_count_; ++point_index)
+            {
+                sum += *val++;
+            }
+            chunk.sum_ = sum;
+        }
+    }
+
+    // NOTE: Chunk sums are combined in file order. Since the chunking depends on what was
+    // cached, the last bits can differ from a cold run or from a single running sum.
+    for (const CachedChunk& chunk : chunks)
+    {
+        result.point_count_ += chunk.point_count_;
+        result.sum_ += chunk.sum_;
+    }
+    result.chunk_count_ = chunks.size();
+    result.file_size_ = file.size_;
+
+    UnmapPointsFile(file);
+    if (first_new_chunk != chunks.size() || result.reused_chunk_count_ == 0 ||
+        header.file_size_ != result.file_size_ || header.file_mtime_ != file_mtime)
+    {
+        header.array_offset_ = array_offset;
+        header.prefix_hash_ = prefix_hash;
+        header.file_size_ = result.file_size_;
+        header.file_mtime_ = file_mtime;
+        SaveIncrementalCache(cache_path, header, chunks);
+    }
+    return true;
+}
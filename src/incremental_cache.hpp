@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+#define INCREMENTAL_CACHE_MAGIC 0x43495648 // 'HVIC'
+#define INCREMENTAL_CACHE_VERSION 2
+#define INCREMENTAL_CACHE_SUFFIX ".hvcache"
+#define INCREMENTAL_CHUNK_BYTES (4ull << 20)
+
+// NOTE: A chunk is a run of whole point objects, from just after the previous chunk's last
+// '}' up to and including its own last '}'. Appending pairs to a file only rewrites the bytes
+// after the final '}', so every cached chunk of the old file stays byte-identical.
+struct CachedChunk
+{
+    uint64_t begin_;
+    uint64_t end_;
+    uint64_t hash_;
+    uint64_t point_count_;
+    double sum_;
+};
+
+struct IncrementalCacheHeader
+{
+    uint32_t magic_;
+    uint32_t version_;
+    uint64_t array_offset_; // first byte after the '[' of the points array
+    uint64_t prefix_hash_;  // hash of everything before array_offset_
+    uint64_t chunk_count_;
+    uint64_t file_size_;    // of the file the chunks were cached from
+    int64_t file_mtime_;    // its last write time, in the filesystem clock's ticks
+};
+
+struct IncrementalResult
+{
+    uint64_t file_size_;
+    uint64_t point_count_;
+    double sum_;
+    uint64_t chunk_count_;
+    uint64_t reused_chunk_count_;
+    uint64_t reused_byte_count_;
+    uint64_t parsed_byte_count_;
+    uint64_t hashed_byte_count_; // cached bytes re-hashed to check they still match
+};
+
+uint64_t HashBytes(const char* data, uint64_t size);
+// NOTE: Without verify_all, a file that only grew is trusted after re-hashing its last cached
+// chunk, so a rerun costs about as much as the appended bytes; verify_all re-hashes them all.
+bool ProcessIncremental(const std::string& filename, bool verify_all, IncrementalResult& result);
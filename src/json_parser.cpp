@@ -0,0 +1,283 @@
+#include <algorithm>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string_view>
+#include "json_parser.hpp"
+
+bool ParseJsonParser(const char* name, JsonParser& parser)
+{
+    std::string_view value = name;
+    if (value == "generic") parser = PARSER_GENERIC;
+    else if (value == "schema") parser = PARSER_SCHEMA;
+    else return false;
+    return true;
+}
+
+const char* FindPointsArray(const char* data, const char* end)
+{
+    const char* key = "\"points\"";
+    const char* pos = std::search(data, end, key, key + 8);
+
+    if (pos == end) {
+        std::cerr << "Missing \"points\" key\n";
+        return nullptr;
+    }
+
+    pos = std::find(pos, end, '[');
+    if (pos == end) {
+        std::cerr << "Missing '[' after \"points\"\n";
+        return nullptr;
+    }
+    return pos + 1; // skip '['
+}
+
+// NOTE: pos points just past the object's '{'. Returns the position just after its '}'.
+static const char* ParseObjectGeneric(const char* pos, const char* end, Point& point)
+{
+    double x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+
+    while (pos < end && *pos != '}') {
+        // Skip whitespace
+        while (pos < end && isspace(*pos)) ++pos;
+
+        if (*pos != '"') break; // expected a key
+
+        ++pos;
+        const char* key_start = pos;
+        while (pos < end && *pos != '"') ++pos;
+        std::string_view key(key_start, pos - key_start);
+        ++pos; // skip closing quote
+
+        // Skip colon
+        while (pos < end && *pos != ':') ++pos;
+        if (pos == end) break;
+        ++pos;
+
+        while (pos < end && isspace(*pos)) ++pos;
+
+        // Parse number
+        const char* val_start = pos;
+        while (pos < end && (*pos == '-' || isdigit(*pos) || *pos == '.')) ++pos;
+        std::string_view val(val_start, pos - val_start);
+
+        double num = std::strtod(val.data(), nullptr);
+
+        if (key == "x0") x0 = num;
+        else if (key == "y0") y0 = num;
+        else if (key == "x1") x1 = num;
+        else if (key == "y1") y1 = num;
+
+        // Skip until next key or end of object
+        while (pos < end && *pos != ',' && *pos != '}') ++pos;
+        if (*pos == ',') ++pos;
+    }
+
+
+    point = { x0, y0, x1, y1 };
+
+    // Skip past '}'
+    while (pos < end && *pos != '}') ++pos;
+    if (pos < end) ++pos;
+    return pos;
+}
+
+static void StorePoint(CustomVector(Point)& points, const Point& point)
+{
+    points.push_back(point);
+}
+
+static void StorePoint(CustomVector(CompactPoint)& points, const Point& point)
+{
+    points.push_back({ CompactFromDegrees(point.x0), CompactFromDegrees(point.y0),
+                       CompactFromDegrees(point.x1), CompactFromDegrees(point.y1) });
+}
+
+template <typename PointVector>
+static const char* ParsePointObjectsGeneric(const char* pos, const char* stop, const char* end, PointVector& points)
+{
+    const char* parsed_end = pos;
+    while (pos < end) {
+        // Skip to next '{', without running past the end of the array
+        while (pos < end && *pos != '{' && *pos != ']') ++pos;
+        if (pos >= stop || *pos == ']') break;
+
+        Point point;
+        pos = ParseObjectGeneric(pos + 1, end, point);
+        StorePoint(points, point);
+        parsed_end = pos;
+    }
+    return parsed_end;
+}
+
+static int FieldFromKey(std::string_view key)
+{
+    if (key == "x0") return 0;
+    if (key == "y0") return 1;
+    if (key == "x1") return 2;
+    if (key == "y1") return 3;
+    return -1;
+}
+
+static void PackLayoutBytes(const char* bytes, uint32_t length, uint64_t* words, uint64_t* masks, uint32_t word_count)
+{
+    for (uint32_t word_index = 0; word_index < word_count; ++word_index)
+    {
+        words[word_index] = 0;
+        masks[word_index] = 0;
+        for (uint32_t byte_index = 0; byte_index < 8; ++byte_index)
+        {
+            uint32_t at = 8*word_index + byte_index;
+            if (at < length)
+            {
+                words[word_index] |= (uint64_t)(unsigned char)bytes[at] << (8*byte_index);
+                masks[word_index] |= (uint64_t)0xFF << (8*byte_index);
+            }
+        }
+    }
+}
+
+bool SniffJsonLayout(const char* object, const char* end, JsonLayout& layout)
+{
+    const char* pos = object;
+    bool seen[4] = {};
+    layout.max_prefix_length_ = 0;
+
+    for (uint32_t slot = 0; slot < 4; ++slot)
+    {
+        const char* prefix_start = pos;
+        if (slot == 0) ++pos; // '{'
+        while (pos < end && isspace(*pos)) ++pos;
+        if (slot != 0)
+        {
+            if (pos == end || *pos != ',') return false;
+            ++pos;
+            while (pos < end && isspace(*pos)) ++pos;
+        }
+
+        if (pos == end || *pos != '"') return false;
+        const char* key_start = ++pos;
+        while (pos < end && *pos != '"') ++pos;
+        if (pos == end) return false;
+        int field = FieldFromKey(std::string_view(key_start, pos - key_start));
+        if (field < 0 || seen[field]) return false;
+        seen[field] = true;
+        ++pos;
+
+        while (pos < end && isspace(*pos)) ++pos;
+        if (pos == end || *pos != ':') return false;
+        ++pos;
+        while (pos < end && isspace(*pos)) ++pos;
+
+        uint32_t prefix_length = (uint32_t)(pos - prefix_start);
+        if (prefix_length > LAYOUT_MAX_PREFIX) return false;
+        layout.field_[slot] = (uint32_t)field;
+        layout.prefix_length_[slot] = prefix_length;
+        layout.max_prefix_length_ = std::max(layout.max_prefix_length_, prefix_length);
+        PackLayoutBytes(prefix_start, prefix_length, layout.prefix_words_[slot], layout.prefix_masks_[slot], 2);
+
+        double value;
+        auto [number_end, error] = std::from_chars(pos, end, value);
+        if (error != std::errc()) return false;
+        pos = number_end;
+    }
+
+    const char* suffix_start = pos;
+    while (pos < end && isspace(*pos)) ++pos;
+    if (pos == end || *pos != '}') return false;
+    ++pos;
+
+    layout.suffix_length_ = (uint32_t)(pos - suffix_start);
+    if (layout.suffix_length_ > LAYOUT_MAX_SUFFIX) return false;
+    PackLayoutBytes(suffix_start, layout.suffix_length_, &layout.suffix_word_, &layout.suffix_mask_, 1);
+    return true;
+}
+
+template <uint32_t WordCount>
+static bool LayoutBytesMatch(const char* pos, const char* end, const uint64_t* words, const uint64_t* masks)
+{
+    if (end - pos < (ptrdiff_t)(8*WordCount)) return false;
+    uint64_t difference = 0;
+    for (uint32_t word_index = 0; word_index < WordCount; ++word_index)
+    {
+        uint64_t word;
+        memcpy(&word, pos + 8*word_index, sizeof(word));
+        difference |= (word ^ words[word_index]) & masks[word_index];
+    }
+    return difference == 0;
+}
+
+// NOTE: object points at a '{'. Returns the position just after its '}', or nullptr as soon
+// as anything differs from the layout, in which case nothing has been consumed.
+template <uint32_t PrefixWords>
+static const char* ParseObjectWithLayout(const char* object, const char* end, const JsonLayout& layout, Point& point)
+{
+    const char* pos = object;
+    double values[4];
+    for (uint32_t slot = 0; slot < 4; ++slot)
+    {
+        if (!LayoutBytesMatch<PrefixWords>(pos, end, layout.prefix_words_[slot], layout.prefix_masks_[slot])) return nullptr;
+        pos += layout.prefix_length_[slot];
+
+        auto [number_end, error] = std::from_chars(pos, end, values[layout.field_[slot]]);
+        if (error != std::errc()) return nullptr;
+        pos = number_end;
+    }
+
+    if (!LayoutBytesMatch<1>(pos, end, &layout.suffix_word_, &layout.suffix_mask_)) return nullptr;
+    point = { values[0], values[1], values[2], values[3] };
+    return pos + layout.suffix_length_;
+}
+
+template <uint32_t PrefixWords, typename PointVector>
+static const char* ParsePointObjectsWithLayout(const char* pos, const char* stop, const char* end, const JsonLayout& layout,
+                                               PointVector& points)
+{
+    const char* parsed_end = pos;
+    while (pos < end) {
+        while (pos < end && *pos != '{' && *pos != ']') ++pos;
+        if (pos >= stop || *pos == ']') break;
+
+        Point point;
+        const char* next = ParseObjectWithLayout<PrefixWords>(pos, end, layout, point);
+        if (!next) {
+            next = ParseObjectGeneric(pos + 1, end, point);
+        }
+        StorePoint(points, point);
+        pos = parsed_end = next;
+    }
+    return parsed_end;
+}
+
+template <typename PointVector>
+static const char* ParsePointObjectsAs(const char* pos, const char* stop, const char* end, PointVector& points)
+{
+    if (g_config.parser_ == PARSER_SCHEMA)
+    {
+        const char* first = pos;
+        while (first < end && *first != '{' && *first != ']') ++first;
+
+        JsonLayout layout;
+        if (first < stop && *first == '{' && SniffJsonLayout(first, end, layout))
+        {
+            // NOTE: Compact keys fit in one 8-byte compare each, pretty-printed ones need two.
+            if (layout.max_prefix_length_ <= 8)
+            {
+                return ParsePointObjectsWithLayout<1>(pos, stop, end, layout, points);
+            }
+            return ParsePointObjectsWithLayout<2>(pos, stop, end, layout, points);
+        }
+    }
+    return ParsePointObjectsGeneric(pos, stop, end, points);
+}
+
+const char* ParsePointObjects(const char* pos, const char* stop, const char* end, CustomVector(Point)& points)
+{
+    return ParsePointObjectsAs(pos, stop, end, points);
+}
+
+const char* ParsePointObjects(const char* pos, const char* stop, const char* end, CustomVector(CompactPoint)& points)
+{
+    return ParsePointObjectsAs(pos, stop, end, points);
+}
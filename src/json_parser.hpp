@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+#include "haversine_processor.hpp"
+
+#define LAYOUT_MAX_PREFIX 16
+#define LAYOUT_MAX_SUFFIX 8
+
+// NOTE: The exact bytes around the four numbers of one point object, e.g. {"x0": then ,"y0":
+// then ,"x1": then ,"y1": then }. When every object in a file is written the same way, a
+// parser holding this only has to confirm the bytes are where it expects and convert numbers.
+struct JsonLayout
+{
+    uint32_t field_[4];                        // which Point member (x0, y0, x1, y1) each value fills
+    uint32_t prefix_length_[4];
+    uint64_t prefix_words_[4][2];              // bytes before each value, the first starting at '{'
+    uint64_t prefix_masks_[4][2];
+    uint32_t suffix_length_;
+    uint64_t suffix_word_;                     // bytes after the last value, up to and including '}'
+    uint64_t suffix_mask_;
+    uint32_t max_prefix_length_;
+};
+
+bool ParseJsonParser(const char* name, JsonParser& parser);
+
+// NOTE: Returns the position just past the '[' of the "points" array, nullptr if there is none.
+const char* FindPointsArray(const char* data, const char* end);
+// NOTE: object points at a '{'. Fails on anything but the four known keys, each appearing once.
+bool SniffJsonLayout(const char* object, const char* end, JsonLayout& layout);
+// NOTE: Parses the point objects whose opening '{' lies before stop (the object itself may
+// extend past it) and returns the position just after the last '}' parsed, pos if none were.
+// With PARSER_SCHEMA the layout is sniffed from the first object, and any object that doesn't
+// match it is handed to the generic parser, so arbitrary valid input still parses.
+const char* ParsePointObjects(const char* pos, const char* stop, const char* end, CustomVector(Point)& points);
+// NOTE: Same, but every coordinate is quantized as it is parsed, so no array of doubles is built.
+const char* ParsePointObjects(const char* pos, const char* stop, const char* end, CustomVector(CompactPoint)& points);
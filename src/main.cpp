@@ -1,180 +1,434 @@
-#include <vector>
-#include <string>
 #include <algorithm>
-#include "haversine_formula.hpp"
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include "autotune.hpp"
+#include "benchmark.hpp"
+#include "distance_matrix.hpp"
+#include "haversine_processor.hpp"
+#include "haversine_server.hpp"
+#include "haversine_stats.hpp"
+#include "incremental_cache.hpp"
+#include "json_parser.hpp"
 #include "perf_profiler.hpp"
-#include "custom_memory_allocator.hpp"
-
-#define CustomVector(type) std::vector<type, CustomMemoryAllocator<type>>
+#include "results_writer.hpp"
+#include "roofline.hpp"
+#include "shard.hpp"
+#include "spatial_index.hpp"
+#include "thread_pool.hpp"
 
-
-struct Point
+struct RunOptions
 {
-    double x0;
-    double y0;
-    double x1;
-    double y1;
+    const char* output_path_;
+    ResultsFormat output_format_;
+    bool stats_;
+    uint32_t top_count_;
+    bool incremental_;
+    bool verify_;
+    bool sharded_;
+    ShardSpec shard_;
+    const char* partial_path_;
+    bool compact_;
+    bool compact_accuracy_;
+    bool compensated_;
 };
-uint64_t ReadPointsJson(const std::string& filename, const CustomVector(char)& buffer);
-void ProcessJson(const char* data, size_t size, CustomVector(Point)& points);
-double SumHaversine(const CustomVector(double)& haversine_vals);
-
-void ProcessJson(const char* data, size_t size, CustomVector(Point)& points)
-{
-    TimeBandwidth(__func__, size);
 
-    const char* end = data + size;
+static RunOptions g_run_options = { nullptr, RESULTS_BINARY, false, 10, false, false, false, {}, nullptr, false, false, false };
 
-    const char* key = "\"points\"";
-    const char* pos = std::search(data, end, key, key + 8);
+static void PrintUsage(const char* program)
+{
+    std::cerr << "      Usage: " << program << " [options] <filename.json>" << std::endl;
+    std::cerr << "             " << program << " [options] serve <socket>" << std::endl;
+    std::cerr << "             " << program << " client <socket> <filename.json> [--requests N] [--connections N] [--inline] [--profile]" << std::endl;
+    std::cerr << "             " << program << " client <socket> --shutdown" << std::endl;
+    std::cerr << "             " << program << " [options] bench <filename.json> [--seconds N] [--save <baseline>] [--compare <baseline>]" << std::endl;
+    std::cerr << "             " << program << " [options] calibrate [--seconds N]" << std::endl;
+    std::cerr << "             " << program << " [options] autotune <filename.json> [--sample MB] [--seconds N]" << std::endl;
+    std::cerr << "             " << program << " [options] --shard I/N|B:E --partial <path> <filename.json>" << std::endl;
+    std::cerr << "             " << program << " merge <partial>..." << std::endl;
+    std::cerr << "             " << program << " [options] matrix <rows.json> [<columns.json>] [--output <matrix.bin>] [--rows <reduction.txt>]" << std::endl;
+    std::cerr << "             " << program << " [options] index <filename.json> [--radius KM] [--knn K] [--queries N] [--brute-force N] [--rebuild]" << std::endl;
+    std::cerr << "    Options: --threads N                   worker threads including the main thread (default: all)" << std::endl;
+    std::cerr << "             --parser schema|generic       layout-specialized parser with fallback (default) or the generic one" << std::endl;
+    std::cerr << "             --output <path>               write every pair's distance to <path>" << std::endl;
+    std::cerr << "             --output-format binary|text   raw doubles (default) or one decimal per line" << std::endl;
+    std::cerr << "             --stats                       min/max/mean, quantiles, histogram and longest pairs" << std::endl;
+    std::cerr << "             --top N                       longest pairs reported by --stats (default: 10)" << std::endl;
+    std::cerr << "             --incremental                 reuse per-chunk sums cached in <filename.json>" INCREMENTAL_CACHE_SUFFIX " and only parse what changed" << std::endl;
+    std::cerr << "             --verify                      with --incremental, re-hash every cached chunk instead of trusting an append" << std::endl;
+    std::cerr << "             --read fread|mmap             read the whole file up front (default) or map it and page it in while parsing" << std::endl;
+    std::cerr << "             --pages huge|thp|small        hugetlb pages with fallback (default), transparent huge pages or 4K pages" << std::endl;
+    std::cerr << "             --keep-input                  don't release input pages as the parser moves past them" << std::endl;
+    std::cerr << "             --compact                     store coordinates as int32 1e-7 degrees, 16 instead of 32 bytes per pair" << std::endl;
+    std::cerr << "             --compact-accuracy            --compact, then compare every distance against the double path" << std::endl;
+    std::cerr << "             --shard I/N|B:E               only the pairs starting in shard I of N equal byte ranges, or in bytes [B, E)" << std::endl;
+    std::cerr << "             --compensated                 sum in double-double like merge does, to check a sharded run against one process" << std::endl;
+    std::cerr << "             --partial <path>              where --shard writes its point count and compensated sum for merge" << std::endl;
+}
 
-    if (pos == end) {
-        std::cerr << "Missing \"points\" key\n";
-        return;
+// NOTE: Returns the number of arguments consumed, 0 if argv[arg_index] isn't an option,
+// -1 if it is one but its value is invalid.
+static int ParseOption(int argc, char* argv[], int arg_index)
+{
+    std::string_view arg = argv[arg_index];
+    if (arg == "--stats")
+    {
+        g_run_options.stats_ = true;
+        return 1;
     }
-
-    pos = std::find(pos, end, '[');
-    if (pos == end) {
-        std::cerr << "Missing '[' after \"points\"\n";
-        return;
+    if (arg == "--incremental")
+    {
+        g_run_options.incremental_ = true;
+        return 1;
+    }
+    if (arg == "--verify")
+    {
+        g_run_options.verify_ = true;
+        return 1;
+    }
+    if (arg == "--keep-input")
+    {
+        g_config.release_input_ = false;
+        return 1;
+    }
+    if (arg == "--compensated")
+    {
+        g_run_options.compensated_ = true;
+        return 1;
+    }
+    if (arg == "--compact" || arg == "--compact-accuracy")
+    {
+        g_run_options.compact_ = true;
+        g_run_options.compact_accuracy_ = g_run_options.compact_accuracy_ || arg == "--compact-accuracy";
+        return 1;
+    }
+    if (arg_index + 1 >= argc)
+    {
+        return 0;
     }
-    ++pos; // skip '['
-
-    while (pos < end) {
-        // Skip to next '{'
-        while (pos < end && *pos != '{') ++pos;
-        if (pos == end) break;
-        ++pos; // skip '{'
-
-        double x0 = 0, y0 = 0, x1 = 0, y1 = 0;
 
-        while (pos < end && *pos != '}') {
-            // Skip whitespace
-            while (pos < end && isspace(*pos)) ++pos;
+    char* value = argv[arg_index + 1];
+    if (arg == "--threads")
+    {
+        g_config.thread_count_ = (uint32_t)strtoul(value, nullptr, 10);
+        return 2;
+    }
+    if (arg == "--parser")
+    {
+        return ParseJsonParser(value, g_config.parser_) ? 2 : -1;
+    }
+    if (arg == "--read")
+    {
+        return ParseReadStrategy(value, g_config.read_strategy_) ? 2 : -1;
+    }
+    if (arg == "--pages")
+    {
+        return ParsePagePolicy(value, g_page_policy) ? 2 : -1;
+    }
+    if (arg == "--top")
+    {
+        g_run_options.top_count_ = (uint32_t)strtoul(value, nullptr, 10);
+        return 2;
+    }
+    if (arg == "--output")
+    {
+        g_run_options.output_path_ = value;
+        return 2;
+    }
+    if (arg == "--output-format")
+    {
+        return ParseResultsFormat(value, g_run_options.output_format_) ? 2 : -1;
+    }
+    if (arg == "--shard")
+    {
+        g_run_options.sharded_ = true;
+        return ParseShardSpec(value, g_run_options.shard_) ? 2 : -1;
+    }
+    if (arg == "--partial")
+    {
+        g_run_options.partial_path_ = value;
+        return 2;
+    }
+    return 0;
+}
 
-            if (*pos != '"') break; // expected a key
+// NOTE: Reparses with doubles and reports how far the compact distances are from the reference ones.
+static void PrintCompactAccuracy(const char* json, uint64_t file_size, const CustomVector(double)& compact_vals)
+{
+    TimeFunction;
+    CustomVector(Point) points;
+    CustomVector(double) reference_vals;
+    ProcessJson(json, file_size, points);
+    ComputeHaversine(points, reference_vals);
 
-            ++pos;
-            const char* key_start = pos;
-            while (pos < end && *pos != '"') ++pos;
-            std::string_view key(key_start, pos - key_start);
-            ++pos; // skip closing quote
+    double max_error = 0, max_relative_error = 0, total_error = 0;
+    long double compact_sum = 0, reference_sum = 0;
+    for (uint64_t point_index = 0; point_index < reference_vals.size(); ++point_index)
+    {
+        double error = std::fabs(compact_vals[point_index] - reference_vals[point_index]);
+        max_error = std::max(max_error, error);
+        total_error += error;
+        if (reference_vals[point_index] > 0)
+        {
+            max_relative_error = std::max(max_relative_error, error / reference_vals[point_index]);
+        }
+        compact_sum += compact_vals[point_index];
+        reference_sum += reference_vals[point_index];
+    }
 
-            // Skip colon
-            while (pos < end && *pos != ':') ++pos;
-            if (pos == end) break;
-            ++pos;
+    double mean_error = reference_vals.empty() ? 0 : total_error / (double)reference_vals.size();
+    std::cout << std::scientific << std::setprecision(3);
+    std::cout << "Compact accuracy against doubles:" << std::endl;
+    std::cout << "  Max error: " << max_error * 1000.0 << " m (relative " << max_relative_error << ")" << std::endl;
+    std::cout << "  Mean error: " << mean_error * 1000.0 << " m" << std::endl;
+    std::cout << "  Sum error: " << (double)(compact_sum - reference_sum) << " km (relative "
+              << (reference_sum != 0 ? (double)((compact_sum - reference_sum) / reference_sum) : 0.0) << ")" << std::endl;
+}
 
-            while (pos < end && isspace(*pos)) ++pos;
+static int ProcessFile(const std::string& filename)
+{
+    if (g_run_options.compact_ && g_run_options.output_path_)
+    {
+        std::cerr << "--compact can't be combined with --output" << std::endl;
+        return 1;
+    }
+    if (g_run_options.compensated_ && g_run_options.output_path_)
+    {
+        std::cerr << "--compensated can't be combined with --output" << std::endl;
+        return 1;
+    }
 
-            // Parse number
-            const char* val_start = pos;
-            while (pos < end && (*pos == '-' || isdigit(*pos) || *pos == '.')) ++pos;
-            std::string_view val(val_start, pos - val_start);
+    CustomVector(Point) points;
 
-            double num = std::strtod(val.data(), nullptr);
+    CustomVector(char) json_buffer;
+    MappedFile json_file = {};
+    const char* json = nullptr;
+    uint64_t file_size = 0;
+    if (g_config.read_strategy_ == READ_MMAP)
+    {
+        if (!MapPointsFile(filename, json_file))
+        {
+            return 1;
+        }
+        json = json_file.data_;
+        file_size = json_file.size_;
+    }
+    else
+    {
+        file_size = ReadPointsJson(filename, json_buffer);
+        json = json_buffer.data();
+    }
+	if (file_size == 0)
+	{
+		return 1;
+	}
 
-            if (key == "x0") x0 = num;
-            else if (key == "y0") y0 = num;
-            else if (key == "x1") x1 = num;
-            else if (key == "y1") y1 = num;
+    // NOTE: --compact-accuracy parses the input a second time, so it has to stay intact.
+    bool release_input = g_config.release_input_ && !g_run_options.compact_accuracy_;
+    CustomVector(CompactPoint) compact_points;
+    if (g_run_options.compact_)
+    {
+        ProcessJson(json, file_size, compact_points, release_input);
+    }
+    else
+    {
+        ProcessJson(json, file_size, points, release_input);
+    }
+    uint64_t point_count = g_run_options.compact_ ? compact_points.size() : points.size();
 
-            // Skip until next key or end of object
-            while (pos < end && *pos != ',' && *pos != '}') ++pos;
-            if (*pos == ',') ++pos;
+    std::vector<HaversineStats> chunk_stats;
+    if (g_run_options.stats_)
+    {
+        chunk_stats.resize(GetHaversineChunkCount(point_count));
+        for (HaversineStats& stats : chunk_stats)
+        {
+            InitializeStats(stats, g_run_options.top_count_);
         }
+    }
+    HaversineStats* chunk_stats_data = g_run_options.stats_ ? chunk_stats.data() : nullptr;
 
-        points.emplace_back(x0, y0, x1, y1);
+    CustomVector(double) haversine_vals;
+    long double sum;
+    if (g_run_options.output_path_)
+    {
+        double written_sum = 0;
+        if (!ComputeAndWriteHaversine(g_run_options.output_path_, g_run_options.output_format_, points, haversine_vals, written_sum, chunk_stats_data))
+        {
+            UnmapPointsFile(json_file);
+            return 1;
+        }
+        sum = written_sum;
+    }
+    else
+    {
+        if (g_run_options.compact_)
+        {
+            ComputeHaversine(compact_points, haversine_vals, chunk_stats_data);
+        }
+        else
+        {
+            ComputeHaversine(points, haversine_vals, chunk_stats_data);
+        }
+        sum = g_run_options.compensated_ ? SumHaversineCompensated(haversine_vals) : SumHaversine(haversine_vals);
+    }
 
-        // Skip past '}'
-        while (pos < end && *pos != '}') ++pos;
-        if (pos < end) ++pos;
+    HaversineStats stats;
+    if (g_run_options.stats_)
+    {
+        stats = MergeChunkStats(chunk_stats, g_run_options.top_count_);
+    }
 
-        // Check if there's a closing ']'
-        while (pos < end && isspace(*pos)) ++pos;
-        if (*pos == ']') break;
+    std::cout << "File size: " << file_size << " bytes" << std::endl;
+    std::cout << "Points: " << point_count << std::endl;
+    std::cout << std::fixed << std::setprecision(16) << "Haversine sum: " << sum << std::endl;
+    if (g_run_options.stats_)
+    {
+        std::cout.flush();
+        PrintStats(stdout, stats);
+    }
+    if (g_run_options.compact_accuracy_)
+    {
+        PrintCompactAccuracy(json, file_size, haversine_vals);
     }
+    UnmapPointsFile(json_file);
+    return 0;
 }
 
-
-double SumHaversine(const CustomVector(double)& haversine_vals)
+static int ProcessFileIncremental(const std::string& filename)
 {
-    TimeBandwidth(__func__, haversine_vals.size() * sizeof(double));
-	double sum = 0;
-	for (auto& val : haversine_vals)
-	{
-        sum += val;
-	}
-	return sum;
+    if (g_run_options.output_path_ || g_run_options.stats_ || g_run_options.compensated_ || g_run_options.compact_)
+    {
+        std::cerr << "--incremental only keeps per-chunk sums and can't be combined with --output, --stats, --compensated or --compact" << std::endl;
+        return 1;
+    }
+
+    IncrementalResult result;
+    if (!ProcessIncremental(filename, g_run_options.verify_, result))
+    {
+        return 1;
+    }
+
+    std::cout << "File size: " << result.file_size_ << " bytes" << std::endl;
+    std::cout << "Points: " << result.point_count_ << std::endl;
+    std::cout << "Reused " << result.reused_chunk_count_ << " of " << result.chunk_count_ << " chunks ("
+              << result.reused_byte_count_ << " bytes, " << result.hashed_byte_count_ << " re-hashed), parsed "
+              << result.parsed_byte_count_ << " bytes" << std::endl;
+    std::cout << std::fixed << std::setprecision(16) << "Haversine sum: " << result.sum_ << std::endl;
+    return 0;
 }
 
-uint64_t ReadPointsJson(const std::string& filename, CustomVector(char)& buffer)
+static int ProcessFileShard(const std::string& filename)
 {
-    TimeFunction;
-    FILE* file = fopen(filename.c_str(), "rb");
-    if (!file) {
-        std::cerr << "  Could not open file: " << filename << std::endl;
-        return 0;
+    if (g_run_options.output_path_ || g_run_options.stats_ || g_run_options.incremental_ || g_run_options.compact_ || !g_run_options.partial_path_)
+    {
+        std::cerr << "--shard needs --partial and can't be combined with --output, --stats, --incremental or --compact" << std::endl;
+        return 1;
     }
 
-    fseek(file, 0, SEEK_END);
-    uint64_t file_size = static_cast<uint64_t>(ftell(file));
-    fseek(file, 0, SEEK_SET);
-
-    buffer.reserve(file_size); // allocate exactly
+    ShardPartial partial;
+    if (!ProcessShard(filename, g_run_options.shard_, partial) || !WriteShardPartial(g_run_options.partial_path_, partial))
     {
-        TimeBandwidth("Read file", file_size);
-        size_t read_size = fread(buffer.data(), 1, file_size, file);
-        if (read_size != file_size) {
-            std::cerr << "  Read size mismatch\n";
-            fclose(file);
-            return 0;
-        }
+        return 1;
     }
 
-    fclose(file);
-    return file_size;
+    std::cout << "File size: " << partial.file_size_ << " bytes" << std::endl;
+    std::cout << "Shard bytes: [" << partial.begin_ << ", " << partial.end_ << ")" << std::endl;
+    std::cout << "Points: " << partial.point_count_ << std::endl;
+    std::cout << std::fixed << std::setprecision(16) << "Haversine sum: " << CompensatedSumValue(partial.sum_) << std::endl;
+    return 0;
 }
 
 int main(int argc, char* argv[])
 {
     BeginProfile();
-    if(argc < 2)
+    ApplyHostTunedConfig();
+
+    int arg_index = 1;
+    while (arg_index < argc)
     {
-        std::cerr << "      Usage: " << argv[0] << " <filename.json>" << std::endl;
+        int consumed = ParseOption(argc, argv, arg_index);
+        if (consumed < 0)
+        {
+            std::cerr << "Invalid value for " << argv[arg_index] << ": " << argv[arg_index + 1] << std::endl;
+            return 1;
+        }
+        if (!consumed)
+        {
+            break;
+        }
+        arg_index += consumed;
+    }
+
+    if (arg_index >= argc)
+    {
+        PrintUsage(argv[0]);
         return 1;
     }
-    std::string filename = argv[1];
-    CustomVector(Point) points;
-        
-    CustomVector(char) json;
-    uint64_t file_size = ReadPointsJson(filename, json);
-	if (file_size == 0)
-	{
-		return 1;
-	}
-	
-    ProcessJson(json.data(), file_size, points);
-    CustomVector(double) haversine_vals;
-    haversine_vals.reserve(points.size());
+
+    std::string_view command = argv[arg_index];
+    if (command == "client" && arg_index + 1 < argc)
     {
-        TimeBandwidth("Haversine", points.size() * sizeof(Point));
-        for (auto& point : points)
-        {
+        return RunClient(argv[arg_index + 1], argc - arg_index - 2, argv + arg_index + 2);
+    }
+    if (command == "merge")
+    {
+        return RunMerge(argc - arg_index - 1, argv + arg_index + 1);
+    }
 
-            double haversine_val = ReferenceHaversine(point.x0, point.y0, point.x1, point.y1, EARTH_RAD);
-            haversine_vals.push_back(haversine_val);
+    StartThreadPool(g_thread_pool, g_config.thread_count_);
+
+    int result;
+    if (command == "serve" && arg_index + 1 < argc)
+    {
+        result = RunServer(argv[arg_index + 1]);
+    }
+    else if (command == "bench")
+    {
+        result = RunBenchmark(argc - arg_index - 1, argv + arg_index + 1);
+    }
+    else if (command == "matrix")
+    {
+        result = RunDistanceMatrix(argc - arg_index - 1, argv + arg_index + 1);
+        if (result == 0)
+        {
+            EndAndPrintProfile();
+        }
+    }
+    else if (command == "index")
+    {
+        result = RunSpatialIndex(argc - arg_index - 1, argv + arg_index + 1);
+        if (result == 0)
+        {
+            EndAndPrintProfile();
+        }
+    }
+    else if (command == "calibrate")
+    {
+        result = RunCalibration(argc - arg_index - 1, argv + arg_index + 1);
+    }
+    else if (command == "autotune")
+    {
+        result = RunAutotune(argc - arg_index - 1, argv + arg_index + 1);
+    }
+    else
+    {
+        if (g_run_options.sharded_)
+        {
+            result = ProcessFileShard(argv[arg_index]);
+        }
+        else
+        {
+            result = g_run_options.incremental_ ? ProcessFileIncremental(argv[arg_index]) : ProcessFile(argv[arg_index]);
+        }
+        if (result == 0)
+        {
+            EndAndPrintProfile();
         }
     }
-   
-    long double sum = SumHaversine(haversine_vals);
-    
-    std::cout << "File size: " << file_size << " bytes" << std::endl;
-    std::cout << "Points: " << points.size() << std::endl; 
-    std::cout << std::fixed << std::setprecision(16) << "Haversine sum: " << sum << std::endl;
-
-    EndAndPrintProfile();
-    
-    return 0;
 
-}
\ No newline at end of file
+    StopThreadPool(g_thread_pool);
+    return result;
+}
@@ -1,6 +1,9 @@
 #include <iostream>
 #include "perf_profiler.hpp"
+#include "allocator_stats.hpp"
 #include "platform_metrics.hpp"
+#include "roofline.hpp"
+#include "timer_calibration.hpp"
 #include "helper.hpp"
 
 #if PROFILER
@@ -26,7 +29,7 @@ void PrintPerf(Perf& perf)
     std::cout << "	Misc output time: " << perf.misc_output_ << " (" << std::fixed << std::setprecision(2) << Percent(perf.misc_output_, perf.total_time_) << "%)" << std::endl;
 }
 
-ProfileBlock::ProfileBlock(char const* label, uint32_t anchor_index, uint64_t byte_count)
+ProfileBlock::ProfileBlock(char const* label, uint32_t anchor_index, uint64_t byte_count, ProfileCeiling ceiling, uint64_t flop_count)
 {
 	parent_index_ = g_profiler_parent;
 	anchor_index_ = anchor_index;
@@ -35,6 +38,8 @@ ProfileBlock::ProfileBlock(char const* label, uint32_t anchor_index, uint64_t by
 	ProfileAnchor* anchor = g_profile_anchors + anchor_index_;
 	old_tsc_elapsed_inclusive_ = anchor->tsc_elapsed_inclusive_;
 	anchor->processed_byte_count_ += byte_count;
+	anchor->processed_flop_count_ += flop_count;
+	anchor->ceiling_ = ceiling;
 	g_profiler_parent = anchor_index_;
 	start_tsc_ = READ_BLOCK_TIMER();
 }
@@ -59,42 +64,90 @@ ProfileBlock::~ProfileBlock()
 	anchor->label_ = label_;
 }
 
-void PrintTimeElapsed(uint64_t total_tsc_elapsed, uint64_t timer_freq,  ProfileAnchor* anchor)
+// NOTE: Shares above 100% are flagged rather than clamped: they mean the calibration
+// underestimates this peak or the block's byte/FLOP count overstates its work.
+static void PrintCeilingShare(FILE* out, double rate, const double* ceiling, char const* ceiling_name)
+{
+	double one_core = 100.0 * rate / ceiling[ROOFLINE_ONE_CORE];
+	double all_cores = 100.0 * rate / ceiling[ROOFLINE_ALL_CORES];
+	fprintf(out, " (%.1f%% of 1-core %s, %.1f%% all-core%s)", one_core, ceiling_name, all_cores,
+	        (one_core > 100.0 || all_cores > 100.0) ? ", above calibrated peak" : "");
+}
+
+void PrintTimeElapsed(FILE* out, uint64_t total_tsc_elapsed, uint64_t timer_freq,  ProfileAnchor* anchor)
 {
 	double percent = 100.0 * ((double)anchor->tsc_elapsed_exclusive_ / (double)total_tsc_elapsed);
-	printf("  %s[%llu]: %llu (%.2f%%", anchor->label_, anchor->hit_count_, anchor->tsc_elapsed_exclusive_, percent);
+	fprintf(out, "  %s[%llu]: %llu (%.2f%%", anchor->label_, anchor->hit_count_, anchor->tsc_elapsed_exclusive_, percent);
 
 	if (anchor->tsc_elapsed_inclusive_ != anchor->tsc_elapsed_exclusive_)
 	{
 		double percent_with_children = 100.0 * ((double)anchor->tsc_elapsed_inclusive_ / (double)total_tsc_elapsed);
-		printf(", %.2f%% w/children", percent_with_children);
+		fprintf(out, ", %.2f%% w/children", percent_with_children);
 	}
-	printf(")");
+	fprintf(out, ")");
+	const Roofline* roofline = GetHostRoofline();
+	double seconds = (double)anchor->tsc_elapsed_inclusive_ / (double)timer_freq;
 	if (anchor->processed_byte_count_)
 	{
 		double megabyte = 1024.0 * 1024.0;
 		double gigabyte = 1024.0 * megabyte;
 
-		double seconds = (double)anchor->tsc_elapsed_inclusive_ / (double)timer_freq;
 		double bytes_per_second = (double)anchor->processed_byte_count_ / seconds;
 		double megabytes = (double)anchor->processed_byte_count_ / (double)megabyte;
 		double gigabytes_per_second = bytes_per_second / gigabyte;
 
-		printf("  %.3fmb at %.2fgb/s", megabytes, gigabytes_per_second);
+		fprintf(out, "  %.3fmb at %.2fgb/s", megabytes, gigabytes_per_second);
+
+		// NOTE: Efficiency against the calibrated bandwidth of the level the per-hit working set fits in.
+		if (roofline && anchor->ceiling_ != CEILING_FLOPS)
+		{
+			RooflineLevel level = RooflineLevelForBytes(*roofline, anchor->processed_byte_count_ / anchor->hit_count_);
+			bool write = anchor->ceiling_ == CEILING_WRITE;
+			char ceiling_name[32];
+			snprintf(ceiling_name, sizeof(ceiling_name), "%s %s", RooflineLevelName(level), write ? "write" : "read");
+			PrintCeilingShare(out, bytes_per_second, write ? roofline->write_bandwidth_[level] : roofline->read_bandwidth_[level], ceiling_name);
+		}
 	}
-	printf("\n");
+	if (anchor->processed_flop_count_)
+	{
+		double flops_per_second = (double)anchor->processed_flop_count_ / seconds;
+		fprintf(out, "  %.2fgflop/s", flops_per_second / 1e9);
+		if (roofline)
+		{
+			PrintCeilingShare(out, flops_per_second, roofline->scalar_flops_, "scalar flops");
+		}
+	}
+	fprintf(out, "\n");
 }
-void PrintAnchorData(uint64_t total_cpu_elapsed, uint64_t timer_freq)
+void PrintAnchorData(FILE* out, uint64_t total_cpu_elapsed, uint64_t timer_freq)
 {
 	for (uint32_t anchor_index = 0; anchor_index < ArrayCount(g_profile_anchors); ++anchor_index)
 	{
 		ProfileAnchor* anchor = g_profile_anchors + anchor_index;
 		if (anchor->tsc_elapsed_inclusive_)
 		{
-			PrintTimeElapsed(total_cpu_elapsed, timer_freq, anchor);
+			PrintTimeElapsed(out, total_cpu_elapsed, timer_freq, anchor);
 		}
 	}
 }
+
+void AddProcessedBytes(uint64_t byte_count)
+{
+	g_profile_anchors[g_profiler_parent].processed_byte_count_ += byte_count;
+}
+
+void ResetProfileAnchors()
+{
+	for (uint32_t anchor_index = 0; anchor_index < ArrayCount(g_profile_anchors); ++anchor_index)
+	{
+		ProfileAnchor* anchor = g_profile_anchors + anchor_index;
+		anchor->tsc_elapsed_exclusive_ = 0;
+		anchor->tsc_elapsed_inclusive_ = 0;
+		anchor->hit_count_ = 0;
+		anchor->processed_byte_count_ = 0;
+		anchor->processed_flop_count_ = 0;
+	}
+}
 #endif
 
 Profiler g_profiler;
@@ -103,6 +156,11 @@ uint64_t EstimateBlockTimerFreq()
 {
 	(void)&EstimateBlockTimerFreq; // NOTE(casey): This has to be voided here to prevent compilers from warning us that it is not used
 
+#ifdef READ_BLOCK_TIMER_FREQ
+	// NOTE: The default block timer is the CPU timer, whose frequency comes from the
+	// calibration subsystem without a busy-wait on most hosts.
+	return READ_BLOCK_TIMER_FREQ();
+#else
 	uint64_t milliseconds_to_wait = 100;
 	uint64_t os_freq = GetOSTimerFreq();
 
@@ -127,23 +185,49 @@ uint64_t EstimateBlockTimerFreq()
 	}
 
 	return block_freq;
+#endif
 }
 void BeginProfile()
 {
+	InitializeOSMetrics();
+	ResetAllocatorStats();
+	g_profiler.start_page_faults_ = ReadOSPageFaultCount();
+	g_profiler.start_peak_resident_bytes_ = ReadOSPeakResidentBytes();
 	g_profiler.start_tsc_ = READ_BLOCK_TIMER();
 }
 
-void EndAndPrintProfile()
+void EndProfile()
 {
 	g_profiler.end_tsc_ = READ_BLOCK_TIMER();
-	uint64_t timer_freq = EstimateBlockTimerFreq();
+	g_profiler.end_page_faults_ = ReadOSPageFaultCount();
+	g_profiler.end_peak_resident_bytes_ = ReadOSPeakResidentBytes();
+}
 
+void PrintProfile(FILE* out, uint64_t timer_freq)
+{
 	uint64_t total_cpu_elapsed = g_profiler.end_tsc_ - g_profiler.start_tsc_;
 
 	if (timer_freq)
 	{
-		printf("\nTotal time: %0.4fms (timer freq %llu)\n", 1000.0 * (double)total_cpu_elapsed / (double)timer_freq, timer_freq);
+		fprintf(out, "\nTotal time: %0.4fms (timer freq %llu", 1000.0 * (double)total_cpu_elapsed / (double)timer_freq, timer_freq);
+#ifdef READ_BLOCK_TIMER_FREQ
+		fprintf(out, ", %s", TimerFreqSourceName(GetTimerCalibration().source_));
+#endif
+		fprintf(out, ")\n");
 	}
 
-	PrintAnchorData(total_cpu_elapsed, timer_freq);
+	PrintAnchorData(out, total_cpu_elapsed, timer_freq);
+}
+
+void EndAndPrintProfile()
+{
+	EndProfile();
+	PrintProfile(stdout, EstimateBlockTimerFreq());
+	PrintAllocatorStats(stdout, g_profiler.end_page_faults_ - g_profiler.start_page_faults_);
+
+	// NOTE: The OS only keeps a high-water mark for the whole process, so this is left out
+	// of the per-request profiles the server sends back.
+	double megabyte = 1024.0 * 1024.0;
+	printf("Peak RSS over process lifetime: %.3fmb (%.3fmb at start)\n", (double)g_profiler.end_peak_resident_bytes_ / megabyte,
+	       (double)g_profiler.start_peak_resident_bytes_ / megabyte);
 }
\ No newline at end of file
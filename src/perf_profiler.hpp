@@ -1,5 +1,6 @@
 #pragma once
 #include <cstdint>
+#include <cstdio>
 #include <iomanip>
 #include <iostream>
 
@@ -9,8 +10,18 @@
 
 #ifndef READ_BLOCK_TIMER
 #define READ_BLOCK_TIMER ReadCPUTimer
+#define READ_BLOCK_TIMER_FREQ GetCPUTimerFreq
 #endif
 
+// NOTE: Which calibrated roofline peak a block is scored against: read or write bandwidth
+// for memory-bound stages, the scalar FLOP rate for compute-bound ones.
+enum ProfileCeiling : uint32_t
+{
+    CEILING_READ,
+    CEILING_WRITE,
+    CEILING_FLOPS,
+};
+
 #if PROFILER
 
 struct Perf
@@ -33,6 +44,8 @@ struct ProfileAnchor
     uint64_t tsc_elapsed_inclusive_;
     uint64_t hit_count_;
     uint64_t processed_byte_count_;
+    uint64_t processed_flop_count_;
+    ProfileCeiling ceiling_;
     char const* label_;
 };
 
@@ -48,22 +61,36 @@ struct ProfileBlock
     uint32_t anchor_index_;
 	uint32_t parent_index_;
 
-    ProfileBlock(char const* label, uint32_t anchor_index, uint64_t byte_count);
+    ProfileBlock(char const* label, uint32_t anchor_index, uint64_t byte_count, ProfileCeiling ceiling = CEILING_READ, uint64_t flop_count = 0);
 
     ~ProfileBlock();
 };
 
-void PrintAnchorData(uint64_t total_cpu_elapsed, uint64_t timer_freq);
-void PrintTimeElapsed(uint64_t total_tsc_elapsed, uint64_t timer_freq, ProfileAnchor* anchor);
+void PrintAnchorData(FILE* out, uint64_t total_cpu_elapsed, uint64_t timer_freq);
+void PrintTimeElapsed(FILE* out, uint64_t total_tsc_elapsed, uint64_t timer_freq, ProfileAnchor* anchor);
+void ResetProfileAnchors();
+// NOTE: For blocks whose byte count is only known once they have done their work.
+void AddProcessedBytes(uint64_t byte_count);
 
 #define NameConcat2(A, B) A##B
 #define NameConcat(A, B) NameConcat2(A, B)
-#define TimeBandwidth(Name, ByteCount) ProfileBlock NameConcat(Block, __LINE__)(Name, ++g_profiler_anchor_count, ByteCount);
+// NOTE: Each call site claims its anchor slot once, the first time it runs, so repeated
+// passes (server requests, repetition tests) accumulate into the same anchor instead of
+// walking off the end of g_profile_anchors. Blocks must only be opened on the main thread.
+#define TimeBandwidthAgainst(Name, ByteCount, Ceiling, FlopCount) static uint32_t NameConcat(Anchor, __LINE__) = ++g_profiler_anchor_count; ProfileBlock NameConcat(Block, __LINE__)(Name, NameConcat(Anchor, __LINE__), ByteCount, Ceiling, FlopCount);
+#define TimeBandwidth(Name, ByteCount) TimeBandwidthAgainst(Name, ByteCount, CEILING_READ, 0)
+#define TimeWriteBandwidth(Name, ByteCount) TimeBandwidthAgainst(Name, ByteCount, CEILING_WRITE, 0)
+#define TimeFlops(Name, ByteCount, FlopCount) TimeBandwidthAgainst(Name, ByteCount, CEILING_FLOPS, FlopCount)
 #define ProfilerEndOfCompilationUnit static_assert(g_profiler_anchor_countc< ArrayCount(g_profiler_anchors), "Number of profile points exceeds size of profiler::anchors_ array")
 #else
 
+#define TimeBandwidthAgainst(...)
 #define TimeBandwidth(...)
+#define TimeWriteBandwidth(...)
+#define TimeFlops(...)
 #define PrintAnchorData(...)
+#define ResetProfileAnchors(...)
+#define AddProcessedBytes(...)
 #define ProfilerEndOfCompilationUnit
 
 #endif
@@ -74,8 +101,14 @@ struct Profiler
 {
     uint64_t start_tsc_;
     uint64_t end_tsc_;
+    uint64_t start_page_faults_;
+    uint64_t end_page_faults_;
+    uint64_t start_peak_resident_bytes_;
+    uint64_t end_peak_resident_bytes_;
 };
 extern Profiler g_profiler;
 uint64_t EstimateBlockTimerFreq();
 void BeginProfile();
+void EndProfile();
+void PrintProfile(FILE* out, uint64_t timer_freq);
 void EndAndPrintProfile();
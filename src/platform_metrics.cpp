@@ -1,4 +1,12 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include "platform_metrics.hpp"
+#if defined(__APPLE__)
+#include <sys/sysctl.h>
+#endif
 
 
 OsPlatform g_platform;
@@ -29,6 +37,14 @@ uint64_t ReadOSPageFaultCount()
     return result;
 }
 
+uint64_t ReadOSPeakResidentBytes()
+{
+	PROCESS_MEMORY_COUNTERS_EX memory_counters = {};
+    memory_counters.cb = sizeof(memory_counters);
+    GetProcessMemoryInfo(g_platform.process_handle_, (PROCESS_MEMORY_COUNTERS *)&memory_counters, sizeof(memory_counters));
+    return memory_counters.PeakWorkingSetSize;
+}
+
 void InitializeOSMetrics()
 {
     if(!g_platform.initialized_)
@@ -40,6 +56,26 @@ void InitializeOSMetrics()
 }
 #else
 
+#ifdef CLOCK_MONOTONIC_RAW
+
+uint64_t GetOSTimerFreq()
+{
+	return 1000000000;
+}
+
+uint64_t ReadOSTimer()
+{
+	// NOTE: MONOTONIC_RAW is not slewed by NTP, which is what we want when measuring
+	// the CPU timer against it.
+	struct timespec value;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &value);
+
+	uint64_t result = GetOSTimerFreq() * (uint64_t)value.tv_sec + (uint64_t)value.tv_nsec;
+	return result;
+}
+
+#else
+
 uint64_t GetOSTimerFreq()
 {
 	return 1000000;
@@ -54,6 +90,8 @@ uint64_t ReadOSTimer()
 	return result;
 }
 
+#endif
+
 uint64_t ReadOSPageFaultCount()
 {
     // NOTE(casey): The course materials are not tested on MacOS/Linux.
@@ -70,6 +108,17 @@ uint64_t ReadOSPageFaultCount()
     return result;
 }
 
+uint64_t ReadOSPeakResidentBytes()
+{
+    struct rusage usage = {};
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return (uint64_t)usage.ru_maxrss; // already bytes on macOS
+#else
+    return (uint64_t)usage.ru_maxrss * 1024;
+#endif
+}
+
 void InitializeOSMetrics()
 {
 	if (!g_platform.initialized_)
@@ -97,10 +146,103 @@ uint64_t ReadCPUTimer()
 
 }
 
-uint64_t GetCPUFreqEstimate(void)
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+static std::string ReadCPUBrandString()
+{
+	uint32_t regs[12] = {};
+	#if _WIN32
+	int info[4];
+	__cpuid(info, 0x80000000);
+	if ((uint32_t)info[0] < 0x80000004) return "";
+	for (uint32_t leaf = 0; leaf < 3; ++leaf)
+	{
+		__cpuid(info, 0x80000002 + leaf);
+		memcpy(regs + 4*leaf, info, sizeof(info));
+	}
+	#else
+	if (__get_cpuid_max(0x80000000, nullptr) < 0x80000004) return "";
+	for (uint32_t leaf = 0; leaf < 3; ++leaf)
+	{
+		__get_cpuid(0x80000002 + leaf, &regs[4*leaf + 0], &regs[4*leaf + 1], &regs[4*leaf + 2], &regs[4*leaf + 3]);
+	}
+	#endif
+	return std::string(reinterpret_cast<const char*>(regs), strnlen(reinterpret_cast<const char*>(regs), sizeof(regs)));
+}
+#endif
+
+std::string GetCPUSignature()
+{
+	std::string result;
+	#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+	result = ReadCPUBrandString();
+	#elif defined(__APPLE__)
+	char brand[256] = {};
+	size_t brand_size = sizeof(brand);
+	if (sysctlbyname("machdep.cpu.brand_string", brand, &brand_size, nullptr, 0) == 0) result = brand;
+	#elif defined(__linux__)
+	std::ifstream cpuinfo("/proc/cpuinfo");
+	std::string line;
+	while (std::getline(cpuinfo, line))
+	{
+		if (line.rfind("model name", 0) == 0 || line.rfind("CPU part", 0) == 0)
+		{
+			result = line.substr(line.find(':') + 1);
+			break;
+		}
+	}
+	#endif
+
+	// NOTE: Trim and squash whitespace so the signature can be used as a single token.
+	std::string signature;
+	for (char c : result)
+	{
+		bool space = (c == ' ' || c == '\t');
+		if (space && (signature.empty() || signature.back() == '_')) continue;
+		signature.push_back(space ? '_' : c);
+	}
+	while (!signature.empty() && signature.back() == '_') signature.pop_back();
+	return signature.empty() ? "unknown" : signature;
+}
+
+std::string GetBootID()
 {
-	uint64_t milliseconds_to_wait = PERF_TIME_TO_WAIT;
+	std::string result;
+	#if defined(__linux__)
+	std::ifstream boot_id("/proc/sys/kernel/random/boot_id");
+	std::getline(boot_id, result);
+	#elif defined(__APPLE__)
+	struct timeval boot_time = {};
+	size_t boot_time_size = sizeof(boot_time);
+	if (sysctlbyname("kern.boottime", &boot_time, &boot_time_size, nullptr, 0) == 0)
+	{
+		result = std::to_string(boot_time.tv_sec) + "." + std::to_string(boot_time.tv_usec);
+	}
+	#endif
+	return result;
+}
 
+std::string GetCacheDirectory()
+{
+	std::filesystem::path result;
+	#if _WIN32
+	if (const char* local_app_data = getenv("LOCALAPPDATA")) result = local_app_data;
+	#else
+	if (const char* xdg_cache = getenv("XDG_CACHE_HOME")) result = xdg_cache;
+	else if (const char* home = getenv("HOME")) result = std::filesystem::path(home) / ".cache";
+	#endif
+	if (result.empty())
+	{
+		return "";
+	}
+
+	result /= "haversineprocessor";
+	std::error_code error;
+	std::filesystem::create_directories(result, error);
+	return error ? "" : result.string();
+}
+
+uint64_t MeasureCPUTimerFreq(uint64_t milliseconds_to_wait)
+{
 	uint64_t os_freq = GetOSTimerFreq();
 	//printf("	OS Freq: %llu (reported)\n", os_freq);
 
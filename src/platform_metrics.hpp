@@ -1,5 +1,6 @@
 #pragma once
 #include <cstdint>
+#include <string>
 #if _WIN32
 
 #include <intrin.h>
@@ -18,9 +19,11 @@ struct OsPlatform
 
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <time.h>
 #if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
 
 #include <x86intrin.h>
+#include <cpuid.h>
 
 #endif
 struct OsPlatform
@@ -34,6 +37,14 @@ extern OsPlatform g_platform;
 uint64_t GetOSTimerFreq();
 uint64_t ReadOSTimer();
 uint64_t ReadCPUTimer();
-uint64_t GetCPUFreqEstimate();
+uint64_t MeasureCPUTimerFreq(uint64_t milliseconds_to_wait = PERF_TIME_TO_WAIT);
 void InitializeOSMetrics();
-uint64_t ReadOSPageFaultCount();
\ No newline at end of file
+uint64_t ReadOSPageFaultCount();
+// NOTE: High-water mark of the process's resident set so far, in bytes.
+uint64_t ReadOSPeakResidentBytes();
+
+// NOTE: Host identification used to key anything we persist between runs (timer calibration,
+// benchmark baselines, tuned configurations).
+std::string GetCPUSignature();
+std::string GetBootID();
+std::string GetCacheDirectory();
\ No newline at end of file
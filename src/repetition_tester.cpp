@@ -69,7 +69,7 @@ void NewTestWave(RepetitionTester &tester, uint64_t target_processed_byte_count,
         tester.target_processed_byte_count_ = target_processed_byte_count;
         tester.cpu_timer_freq_ = cpu_timer_freq;
         tester.print_new_minimums_ = true;
-        tester.results_.min_.e[RepetitionValueType::CPUTIMER] = (double)-1;
+        tester.results_.min_.e[RepetitionValueType::CPUTIMER] = (uint64_t)-1;
     }
     else if(tester.mode_ == TestMode::COMPLETED)
     {
@@ -143,6 +143,25 @@ bool IsTesting(RepetitionTester &tester)
                     results.total_.e[e_index] += accum.e[e_index];
                 }
                 
+                uint64_t cpu_time = accum.e[RepetitionValueType::CPUTIMER];
+                uint32_t slot = results.fastest_count_;
+                if(slot < REPETITION_FASTEST_COUNT)
+                {
+                    ++results.fastest_count_;
+                }
+                else if(cpu_time < results.fastest_[REPETITION_FASTEST_COUNT - 1])
+                {
+                    slot = REPETITION_FASTEST_COUNT - 1;
+                }
+                if(slot < REPETITION_FASTEST_COUNT)
+                {
+                    for(; slot > 0 && results.fastest_[slot - 1] > cpu_time; --slot)
+                    {
+                        results.fastest_[slot] = results.fastest_[slot - 1];
+                    }
+                    results.fastest_[slot] = cpu_time;
+                }
+                
                 if(results.max_.e[RepetitionValueType::CPUTIMER] < accum.e[RepetitionValueType::CPUTIMER])
                 {
                     results.max_ = accum;
@@ -179,4 +198,17 @@ bool IsTesting(RepetitionTester &tester)
     
     bool result = (tester.mode_ == TestMode::TESTING);
     return result;
-}
\ No newline at end of file
+}
+
+uint64_t TypicalFastCpuTime(const RepetitionTestResults &results)
+{
+    uint64_t test_count = results.total_.e[RepetitionValueType::TESTCOUNT];
+    uint64_t count = test_count > 2 ? (test_count + 1) / 2 : test_count;
+    if(count > results.fastest_count_)
+    {
+        count = results.fastest_count_;
+    }
+    
+    uint64_t result = count ? results.fastest_[count - 1] : 0;
+    return result;
+}
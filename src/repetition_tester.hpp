@@ -25,11 +25,17 @@ struct RepetitionValue
     uint64_t e[RepetitionValueType::COUNT];
 };
 
+#define REPETITION_FASTEST_COUNT 8
+
 struct RepetitionTestResults
 {
     RepetitionValue total_;
     RepetitionValue min_;
     RepetitionValue max_;
+    // NOTE: CPU times of the fastest repetitions, ascending. Unlike max_ these leave out the
+    // cold first run, so their spread is a usable measure of run-to-run noise.
+    uint64_t fastest_[REPETITION_FASTEST_COUNT];
+    uint32_t fastest_count_;
 };
 
 struct RepetitionTester
@@ -56,4 +62,6 @@ void NewTestWave(RepetitionTester &tester, uint64_t target_processed_byte_count,
 void BeginTime(RepetitionTester &tester);
 void EndTime(RepetitionTester &tester);
 void CountBytes(RepetitionTester &tester, uint64_t byte_count);
-bool IsTesting(RepetitionTester &tester);
\ No newline at end of file
+bool IsTesting(RepetitionTester &tester);
+// NOTE: The slowest of the fastest half of the repetitions (at most REPETITION_FASTEST_COUNT).
+uint64_t TypicalFastCpuTime(const RepetitionTestResults &results);
\ No newline at end of file
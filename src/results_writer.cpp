@@ -0,0 +1,213 @@
+#include <atomic>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string_view>
+#include "results_writer.hpp"
+#include "haversine_formula.hpp"
+#include "perf_profiler.hpp"
+#include "thread_pool.hpp"
+
+#if !_WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// NOTE: to_chars never needs more than 24 characters for the shortest form of a double.
+#define MAX_FORMATTED_DOUBLE 24
+
+bool ParseResultsFormat(const char* name, ResultsFormat& format)
+{
+    std::string_view value = name;
+    if (value == "binary" || value == "bin") format = RESULTS_BINARY;
+    else if (value == "text" || value == "txt") format = RESULTS_TEXT;
+    else return false;
+    return true;
+}
+
+static bool WriteBinaryResults(const char* path, const CustomVector(Point)& points, double& sum, HaversineStats* chunk_stats)
+{
+    uint64_t point_count = points.size();
+    uint64_t byte_count = point_count * sizeof(double);
+
+#if _WIN32
+    CustomVector(double) haversine_vals;
+    ComputeHaversine(points, haversine_vals, chunk_stats);
+    sum = SumHaversine(haversine_vals);
+
+    TimeWriteBandwidth("Write results", byte_count);
+    FILE* file = fopen(path, "wb");
+    if (!file || fwrite(haversine_vals.data(), 1, byte_count, file) != byte_count)
+    {
+        std::cerr << "  Could not write results: " << path << std::endl;
+        if (file) fclose(file);
+        return false;
+    }
+    fclose(file);
+    return true;
+#else
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        std::cerr << "  Could not create results file: " << path << std::endl;
+        return false;
+    }
+
+    if (byte_count == 0)
+    {
+        sum = 0;
+        close(fd);
+        return true;
+    }
+
+    // NOTE: The output is written through a shared mapping, so the blocks are reserved up
+    // front: faulting in a page of a sparse file on a full disk raises SIGBUS instead of
+    // returning an error. Reserving and first-touching the pages is charged to its own stage
+    // so the Haversine stage is charged only for computing into them.
+    void* mapped = MAP_FAILED;
+    {
+        TimeWriteBandwidth("Reserve results", byte_count);
+#if defined(__APPLE__)
+        fstore_t store = { F_ALLOCATEALL, F_PEOFPOSMODE, 0, (off_t)byte_count, 0 };
+        bool reserved = fcntl(fd, F_PREALLOCATE, &store) != -1 && ftruncate(fd, byte_count) == 0;
+#else
+        bool reserved = posix_fallocate(fd, 0, byte_count) == 0;
+#endif
+        if (!reserved)
+        {
+            std::cerr << "  Could not reserve " << byte_count << " bytes for results file: " << path << std::endl;
+            close(fd);
+            return false;
+        }
+
+        mapped = mmap(nullptr, byte_count, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED)
+        {
+            std::cerr << "  Could not map results file: " << path << std::endl;
+            close(fd);
+            return false;
+        }
+
+        volatile char* output_bytes = static_cast<volatile char*>(mapped);
+        for (uint64_t offset = 0; offset < byte_count; offset += 4096)
+        {
+            output_bytes[offset] = 0;
+        }
+    }
+
+    double* haversine_vals = static_cast<double*>(mapped);
+    ComputeHaversine(points.data(), haversine_vals, point_count, chunk_stats);
+    sum = SumHaversine(haversine_vals, point_count);
+
+    // NOTE: Writeback errors only surface through msync; a bare munmap would drop them.
+    bool written;
+    {
+        TimeWriteBandwidth("Write results", byte_count);
+        written = msync(mapped, byte_count, MS_SYNC) == 0;
+        written = (munmap(mapped, byte_count) == 0) && written;
+        written = (close(fd) == 0) && written;
+    }
+    if (!written)
+    {
+        std::cerr << "  Could not write results: " << path << std::endl;
+        return false;
+    }
+    return true;
+#endif
+}
+
+static bool WriteTextResults(const char* path, const CustomVector(Point)& points, CustomVector(double)& haversine_vals, double& sum,
+                             HaversineStats* chunk_stats)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file)
+    {
+        std::cerr << "  Could not create results file: " << path << std::endl;
+        return false;
+    }
+
+    uint64_t point_count = points.size();
+    haversine_vals.resize(point_count);
+
+    const Point* point_data = points.data();
+    double* haversine_data = haversine_vals.data();
+    uint64_t chunk_count = GetHaversineChunkCount(point_count);
+    std::unique_ptr<std::string[]> chunk_text(new std::string[chunk_count]);
+    std::unique_ptr<std::atomic<bool>[]> chunk_done(new std::atomic<bool>[chunk_count]);
+    for (uint64_t chunk_index = 0; chunk_index < chunk_count; ++chunk_index)
+    {
+        chunk_done[chunk_index] = false;
+    }
+
+    bool written = true;
+    {
+        TimeFlops(chunk_stats ? "Haversine+Stats" : "Haversine", point_count * sizeof(Point), point_count * HAVERSINE_NOMINAL_FLOPS);
+
+        // NOTE: Workers compute and format whole chunks while this thread writes finished
+        // chunks out in order, so formatting and I/O overlap the Haversine stage.
+        RunJobsAsync(g_thread_pool, chunk_count, [&](uint64_t chunk_index)
+        {
+            ComputeHaversineChunk(point_data, haversine_data, point_count, chunk_index, chunk_stats);
+
+            uint64_t begin = chunk_index * g_config.haversine_chunk_size_;
+            uint64_t end = std::min(begin + g_config.haversine_chunk_size_, point_count);
+            std::string& text = chunk_text[chunk_index];
+            text.resize((end - begin) * (MAX_FORMATTED_DOUBLE + 1));
+            char* at = text.data();
+            char* text_end = at + text.size();
+            for (uint64_t point_index = begin; point_index < end; ++point_index)
+            {
+                at = std::to_chars(at, text_end, haversine_data[point_index]).ptr;
+                *at++ = '\n';
+            }
+            text.resize(at - text.data());
+
+            chunk_done[chunk_index].store(true, std::memory_order_release);
+            chunk_done[chunk_index].notify_one();
+        });
+
+        // NOTE: Only the fwrite calls are timed as Write results; while this thread waits for
+        // a chunk it runs jobs itself, and that work belongs to the Haversine stage.
+        for (uint64_t chunk_index = 0; chunk_index < chunk_count; ++chunk_index)
+        {
+            while (!chunk_done[chunk_index].load(std::memory_order_acquire))
+            {
+                if (!RunOneJob(g_thread_pool))
+                {
+                    chunk_done[chunk_index].wait(false, std::memory_order_acquire);
+                }
+            }
+
+            std::string& text = chunk_text[chunk_index];
+            {
+                TimeWriteBandwidth("Write results", text.size());
+                written = written && fwrite(text.data(), 1, text.size(), file) == text.size();
+            }
+            std::string().swap(text);
+        }
+        WaitForJobs(g_thread_pool);
+    }
+
+    written = (fclose(file) == 0) && written;
+    if (!written)
+    {
+        std::cerr << "  Could not write results: " << path << std::endl;
+        return false;
+    }
+
+    sum = SumHaversine(haversine_vals);
+    return true;
+}
+
+bool ComputeAndWriteHaversine(const char* path, ResultsFormat format, const CustomVector(Point)& points,
+                              CustomVector(double)& haversine_vals, double& sum, HaversineStats* chunk_stats)
+{
+    if (format == RESULTS_TEXT)
+    {
+        return WriteTextResults(path, points, haversine_vals, sum, chunk_stats);
+    }
+    return WriteBinaryResults(path, points, sum, chunk_stats);
+}
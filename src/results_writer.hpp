@@ -0,0 +1,17 @@
+#pragma once
+#include <cstdint>
+#include "haversine_processor.hpp"
+
+enum ResultsFormat : uint32_t
+{
+    RESULTS_BINARY, // packed little-endian doubles, one per pair, written through a shared mapping
+    RESULTS_TEXT,   // one shortest round-trip decimal per line
+};
+
+bool ParseResultsFormat(const char* name, ResultsFormat& format);
+
+// NOTE: Replaces ComputeHaversine + SumHaversine when per-pair results are requested. The
+// distances are written while they are being computed rather than in a pass afterwards.
+// haversine_vals is only filled in text mode, binary mode computes straight into the file.
+bool ComputeAndWriteHaversine(const char* path, ResultsFormat format, const CustomVector(Point)& points,
+                              CustomVector(double)& haversine_vals, double& sum, HaversineStats* chunk_stats = nullptr);
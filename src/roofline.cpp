@@ -0,0 +1,380 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "roofline.hpp"
+#include "custom_memory_allocator.hpp"
+#include "platform_metrics.hpp"
+#include "repetition_tester.hpp"
+#include "thread_pool.hpp"
+#include "timer_calibration.hpp"
+
+#if !_WIN32
+#include <unistd.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define CompilerBarrier() _ReadWriteBarrier()
+#define NoVectorize
+#else
+#define CompilerBarrier() asm volatile("" ::: "memory")
+#if defined(__clang__)
+#define NoVectorize
+#else
+#define NoVectorize __attribute__((optimize("no-tree-vectorize")))
+#endif
+#endif
+
+#define ROOFLINE_READ_LANES 16
+#define ROOFLINE_FLOP_LANES 32
+#define ROOFLINE_MIN_TRAFFIC (64ull << 20) // bytes moved per repetition so small levels still time cleanly
+#define ROOFLINE_FLOP_ITERATIONS (1ull << 22)
+
+static char const* scope_names[ROOFLINE_SCOPE_COUNT] = { "1-core", "all-core" };
+
+char const* RooflineLevelName(RooflineLevel level)
+{
+    static char const* names[ROOFLINE_LEVEL_COUNT] = { "L1", "L2", "L3", "DRAM" };
+    return level < ROOFLINE_LEVEL_COUNT ? names[level] : "?";
+}
+
+RooflineLevel RooflineLevelForBytes(const Roofline& roofline, uint64_t byte_count)
+{
+    for (uint32_t level = ROOFLINE_L1; level < ROOFLINE_DRAM; ++level)
+    {
+        if (byte_count <= roofline.level_capacity_[level])
+        {
+            return (RooflineLevel)level;
+        }
+    }
+    return ROOFLINE_DRAM;
+}
+
+bool SaveRoofline(const std::string& path, const Roofline& roofline)
+{
+    std::ofstream file(path, std::ios::trunc);
+    file << ROOFLINE_FILE_HEADER << " " << ROOFLINE_FILE_VERSION << "\n";
+    file << "cpu " << roofline.cpu_signature_ << "\n";
+    file << "threads " << roofline.thread_count_ << "\n";
+    file << "# level capacity read_1core read_allcore write_1core write_allcore (bytes/s)\n";
+    for (uint32_t level = 0; level < ROOFLINE_LEVEL_COUNT; ++level)
+    {
+        file << "level " << RooflineLevelName((RooflineLevel)level) << " " << roofline.level_capacity_[level];
+        for (uint32_t scope = 0; scope < ROOFLINE_SCOPE_COUNT; ++scope) file << " " << roofline.read_bandwidth_[level][scope];
+        for (uint32_t scope = 0; scope < ROOFLINE_SCOPE_COUNT; ++scope) file << " " << roofline.write_bandwidth_[level][scope];
+        file << "\n";
+    }
+    file << "flops scalar " << roofline.scalar_flops_[ROOFLINE_ONE_CORE] << " " << roofline.scalar_flops_[ROOFLINE_ALL_CORES] << "\n";
+    file << "flops simd " << roofline.simd_flops_[ROOFLINE_ONE_CORE] << " " << roofline.simd_flops_[ROOFLINE_ALL_CORES] << "\n";
+    return (bool)file;
+}
+
+bool LoadRoofline(const std::string& path, Roofline& roofline)
+{
+    std::ifstream file(path);
+    std::string header;
+    uint32_t version = 0;
+    if (!(file >> header >> version) || header != ROOFLINE_FILE_HEADER || version != ROOFLINE_FILE_VERSION)
+    {
+        return false;
+    }
+
+    roofline = {};
+    uint32_t levels_read = 0;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::istringstream fields(line);
+        std::string kind;
+        fields >> kind;
+        if (kind == "cpu") fields >> roofline.cpu_signature_;
+        else if (kind == "threads") fields >> roofline.thread_count_;
+        else if (kind == "level" && levels_read < ROOFLINE_LEVEL_COUNT)
+        {
+            std::string name;
+            double* read = roofline.read_bandwidth_[levels_read];
+            double* write = roofline.write_bandwidth_[levels_read];
+            if (fields >> name >> roofline.level_capacity_[levels_read] >> read[0] >> read[1] >> write[0] >> write[1])
+            {
+                ++levels_read;
+            }
+        }
+        else if (kind == "flops")
+        {
+            std::string name;
+            fields >> name;
+            double* flops = (name == "simd") ? roofline.simd_flops_ : roofline.scalar_flops_;
+            fields >> flops[ROOFLINE_ONE_CORE] >> flops[ROOFLINE_ALL_CORES];
+        }
+    }
+    return levels_read == ROOFLINE_LEVEL_COUNT;
+}
+
+std::string GetRooflinePath()
+{
+    std::string directory = GetCacheDirectory();
+    if (directory.empty())
+    {
+        return "";
+    }
+    return (std::filesystem::path(directory) / ("roofline-" + GetCPUSignature())).string();
+}
+
+const Roofline* GetHostRoofline()
+{
+    static Roofline roofline;
+    static bool loaded = [] {
+        std::string path = GetRooflinePath();
+        return !path.empty() && LoadRoofline(path, roofline) && roofline.cpu_signature_ == GetCPUSignature();
+    }();
+    return loaded ? &roofline : nullptr;
+}
+
+static uint64_t GetCacheCapacity(RooflineLevel level)
+{
+    static const uint64_t fallback[ROOFLINE_DRAM] = { 32ull << 10, 1ull << 20, 32ull << 20 };
+    long size = 0;
+    #if defined(_SC_LEVEL1_DCACHE_SIZE)
+    static const int names[ROOFLINE_DRAM] = { _SC_LEVEL1_DCACHE_SIZE, _SC_LEVEL2_CACHE_SIZE, _SC_LEVEL3_CACHE_SIZE };
+    size = sysconf(names[level]);
+    #endif
+    return size > 0 ? (uint64_t)size : fallback[level];
+}
+
+static double ReadKernel(const double* data, uint64_t count, uint64_t passes)
+{
+    double lanes[ROOFLINE_READ_LANES] = {};
+    for (uint64_t pass = 0; pass < passes; ++pass)
+    {
+        for (uint64_t index = 0; index + ROOFLINE_READ_LANES <= count; index += ROOFLINE_READ_LANES)
+        {
+            for (uint32_t lane = 0; lane < ROOFLINE_READ_LANES; ++lane)
+            {
+                lanes[lane] += data[index + lane];
+            }
+        }
+        CompilerBarrier();
+    }
+
+    double result = 0;
+    for (double lane : lanes) result += lane;
+    return result;
+}
+
+static void WriteKernel(double* data, uint64_t count, uint64_t passes)
+{
+    for (uint64_t pass = 0; pass < passes; ++pass)
+    {
+        double value = (double)pass;
+        for (uint64_t index = 0; index < count; ++index)
+        {
+            data[index] = value;
+        }
+        // NOTE: Without this the compiler is free to drop every pass but the last.
+        CompilerBarrier();
+    }
+}
+
+NoVectorize static double ScalarFlopKernel(uint64_t iterations)
+{
+    double a0 = 1.0, a1 = 1.1, a2 = 1.2, a3 = 1.3, a4 = 1.4, a5 = 1.5, a6 = 1.6, a7 = 1.7;
+    const double mul = 0.9999999, add = 1e-7;
+    for (uint64_t iteration = 0; iteration < iterations; ++iteration)
+    {
+        a0 = a0*mul + add; a1 = a1*mul + add; a2 = a2*mul + add; a3 = a3*mul + add;
+        a4 = a4*mul + add; a5 = a5*mul + add; a6 = a6*mul + add; a7 = a7*mul + add;
+    }
+    return a0 + a1 + a2 + a3 + a4 + a5 + a6 + a7;
+}
+
+static double SimdFlopKernel(uint64_t iterations)
+{
+    double lanes[ROOFLINE_FLOP_LANES];
+    for (uint32_t lane = 0; lane < ROOFLINE_FLOP_LANES; ++lane) lanes[lane] = 1.0 + 0.01 * lane;
+    const double mul = 0.9999999, add = 1e-7;
+    for (uint64_t iteration = 0; iteration < iterations; ++iteration)
+    {
+        for (uint32_t lane = 0; lane < ROOFLINE_FLOP_LANES; ++lane)
+        {
+            lanes[lane] = lanes[lane]*mul + add;
+        }
+    }
+
+    double result = 0;
+    for (double lane : lanes) result += lane;
+    return result;
+}
+
+static double RatePerSecond(const RepetitionTester& tester, uint64_t timer_freq)
+{
+    uint64_t min_cycles = tester.results_.min_.e[RepetitionValueType::CPUTIMER];
+    double seconds = SecondsFromCpuTime((double)min_cycles, timer_freq);
+    return seconds > 0 ? (double)tester.target_processed_byte_count_ / seconds : 0;
+}
+
+// NOTE: Kernel results land here so they are not optimized away, one cache line per thread so
+// the threads of an all-core run do not fight over it.
+struct alignas(64) RooflineSink
+{
+    volatile double value_;
+};
+
+// NOTE: Thread 0 is always this thread, and a pool thread keeps its index for the life of the
+// pool, so a buffer set up through here is measured by the same thread that first touched it.
+template <typename Job>
+static void RunOnThreads(uint32_t thread_count, Job job)
+{
+    if (thread_count == 1)
+    {
+        job(0);
+    }
+    else
+    {
+        RunOnEachThread(g_thread_pool, [&](uint64_t thread_index) { job((uint32_t)thread_index); });
+    }
+}
+
+// NOTE: Runs job on every pool thread at once (or just this one) and returns the best total
+// rate, where work_per_thread is the bytes or flops one job accounts for. Thread 0 waits for
+// every thread to check in, starts the clock and only then releases them, so waking the workers
+// is not charged to the kernel and no thread gets a head start on it.
+template <typename Job>
+static double MeasureRate(char const* label, RooflineScope scope, uint64_t work_per_thread, uint32_t seconds_to_try, Job job)
+{
+    uint32_t thread_count = (scope == ROOFLINE_ALL_CORES) ? GetThreadCount(g_thread_pool) : 1;
+    uint64_t timer_freq = GetCPUTimerFreq();
+
+    printf("\n--- %s (%s) ---\n", label, scope_names[scope]);
+    RepetitionTester tester = {};
+    NewTestWave(tester, work_per_thread * thread_count, timer_freq, seconds_to_try);
+    tester.print_new_minimums_ = false;
+    std::atomic<uint32_t> arrived;
+    std::atomic<bool> started;
+    while (IsTesting(tester))
+    {
+        arrived = 0;
+        started = false;
+        RunOnThreads(thread_count, [&](uint32_t thread_index)
+        {
+            arrived.fetch_add(1);
+            if (thread_index == 0)
+            {
+                while (arrived.load() < thread_count) std::this_thread::yield();
+                BeginTime(tester);
+                started = true;
+            }
+            while (!started.load()) std::this_thread::yield();
+            job(thread_index);
+        });
+        EndTime(tester);
+        CountBytes(tester, work_per_thread * thread_count);
+    }
+    return RatePerSecond(tester, timer_freq);
+}
+
+static void PrintRoofline(const Roofline& roofline)
+{
+    double gigabyte = 1024.0 * 1024.0 * 1024.0;
+    printf("\nRoofline for %s (%u threads)\n", roofline.cpu_signature_.c_str(), roofline.thread_count_);
+    printf("  %-5s %10s %12s %12s %12s %12s\n", "Level", "Capacity", "Read 1-core", "Read all", "Write 1-core", "Write all");
+    for (uint32_t level = 0; level < ROOFLINE_LEVEL_COUNT; ++level)
+    {
+        char capacity[32];
+        if (roofline.level_capacity_[level]) snprintf(capacity, sizeof(capacity), "%lluKB", (unsigned long long)(roofline.level_capacity_[level] >> 10));
+        else snprintf(capacity, sizeof(capacity), "-");
+        printf("  %-5s %10s %9.2fgb/s %9.2fgb/s %9.2fgb/s %9.2fgb/s\n", RooflineLevelName((RooflineLevel)level), capacity,
+               roofline.read_bandwidth_[level][ROOFLINE_ONE_CORE] / gigabyte, roofline.read_bandwidth_[level][ROOFLINE_ALL_CORES] / gigabyte,
+               roofline.write_bandwidth_[level][ROOFLINE_ONE_CORE] / gigabyte, roofline.write_bandwidth_[level][ROOFLINE_ALL_CORES] / gigabyte);
+    }
+    printf("  Scalar %.2f / %.2f gflop/s, SIMD %.2f / %.2f gflop/s (1-core / all-core)\n",
+           roofline.scalar_flops_[ROOFLINE_ONE_CORE] / 1e9, roofline.scalar_flops_[ROOFLINE_ALL_CORES] / 1e9,
+           roofline.simd_flops_[ROOFLINE_ONE_CORE] / 1e9, roofline.simd_flops_[ROOFLINE_ALL_CORES] / 1e9);
+}
+
+int RunCalibration(int argc, char* argv[])
+{
+    uint32_t seconds_to_try = 1;
+    for (int arg_index = 0; arg_index < argc; ++arg_index)
+    {
+        std::string_view arg = argv[arg_index];
+        if (arg == "--seconds" && arg_index + 1 < argc) seconds_to_try = (uint32_t)strtoul(argv[++arg_index], nullptr, 10);
+    }
+
+    Roofline roofline = {};
+    roofline.cpu_signature_ = GetCPUSignature();
+    roofline.thread_count_ = GetThreadCount(g_thread_pool);
+    for (uint32_t level = ROOFLINE_L1; level < ROOFLINE_DRAM; ++level)
+    {
+        roofline.level_capacity_[level] = GetCacheCapacity((RooflineLevel)level);
+    }
+    uint64_t dram_bytes = std::clamp<uint64_t>(4 * roofline.level_capacity_[ROOFLINE_L3], 256ull << 20, 1ull << 30);
+
+    std::vector<std::vector<double, CustomMemoryAllocator<double>>> buffers(roofline.thread_count_);
+    std::vector<RooflineSink> sinks(roofline.thread_count_);
+    for (uint32_t level = 0; level < ROOFLINE_LEVEL_COUNT; ++level)
+    {
+        for (uint32_t scope = 0; scope < ROOFLINE_SCOPE_COUNT; ++scope)
+        {
+            // NOTE: Half of a level's capacity stays resident in it. L1 and L2 are private, so
+            // every thread gets that much; L3 and DRAM are shared, so the threads split it.
+            uint32_t thread_count = (scope == ROOFLINE_ALL_CORES) ? roofline.thread_count_ : 1;
+            uint64_t working_set = (level == ROOFLINE_DRAM) ? dram_bytes : roofline.level_capacity_[level] / 2;
+            if (level >= ROOFLINE_L3) working_set /= thread_count;
+            working_set = std::max<uint64_t>(working_set & ~(uint64_t)(ROOFLINE_READ_LANES * sizeof(double) - 1), ROOFLINE_READ_LANES * sizeof(double));
+
+            uint64_t count = working_set / sizeof(double);
+            uint64_t passes = std::max<uint64_t>(1, ROOFLINE_MIN_TRAFFIC / working_set);
+            RunOnThreads(thread_count, [&](uint32_t thread_index)
+            {
+                buffers[thread_index].assign(count, 1.0);
+            });
+
+            char label[32];
+            snprintf(label, sizeof(label), "%s read", RooflineLevelName((RooflineLevel)level));
+            roofline.read_bandwidth_[level][scope] = MeasureRate(label, (RooflineScope)scope, working_set * passes, seconds_to_try, [&](uint32_t thread_index)
+            {
+                sinks[thread_index].value_ = ReadKernel(buffers[thread_index].data(), count, passes);
+            });
+
+            snprintf(label, sizeof(label), "%s write", RooflineLevelName((RooflineLevel)level));
+            roofline.write_bandwidth_[level][scope] = MeasureRate(label, (RooflineScope)scope, working_set * passes, seconds_to_try, [&](uint32_t thread_index)
+            {
+                WriteKernel(buffers[thread_index].data(), count, passes);
+            });
+        }
+    }
+    buffers.clear();
+
+    uint64_t scalar_flops = ROOFLINE_FLOP_ITERATIONS * 8 * 2;
+    uint64_t simd_flops = ROOFLINE_FLOP_ITERATIONS * ROOFLINE_FLOP_LANES * 2;
+    for (uint32_t scope = 0; scope < ROOFLINE_SCOPE_COUNT; ++scope)
+    {
+        roofline.scalar_flops_[scope] = MeasureRate("Scalar flops", (RooflineScope)scope, scalar_flops, seconds_to_try, [&](uint32_t thread_index)
+        {
+            sinks[thread_index].value_ = ScalarFlopKernel(ROOFLINE_FLOP_ITERATIONS);
+        });
+        roofline.simd_flops_[scope] = MeasureRate("SIMD flops", (RooflineScope)scope, simd_flops, seconds_to_try, [&](uint32_t thread_index)
+        {
+            sinks[thread_index].value_ = SimdFlopKernel(ROOFLINE_FLOP_ITERATIONS);
+        });
+    }
+
+    PrintRoofline(roofline);
+
+    std::string path = GetRooflinePath();
+    if (path.empty() || !SaveRoofline(path, roofline))
+    {
+        std::cerr << "Could not save roofline calibration" << std::endl;
+        return 1;
+    }
+    printf("\nSaved to %s\n", path.c_str());
+    return 0;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+#define ROOFLINE_FILE_HEADER "haversine-roofline"
+#define ROOFLINE_FILE_VERSION 1
+
+enum RooflineLevel : uint32_t
+{
+    ROOFLINE_L1,
+    ROOFLINE_L2,
+    ROOFLINE_L3,
+    ROOFLINE_DRAM,
+
+    ROOFLINE_LEVEL_COUNT,
+};
+
+enum RooflineScope : uint32_t
+{
+    ROOFLINE_ONE_CORE,
+    ROOFLINE_ALL_CORES,
+
+    ROOFLINE_SCOPE_COUNT,
+};
+
+// NOTE: Peak rates measured on this host; bandwidths in bytes/s, FLOP rates in flop/s.
+struct Roofline
+{
+    std::string cpu_signature_;
+    uint32_t thread_count_;
+    uint64_t level_capacity_[ROOFLINE_LEVEL_COUNT]; // cache size per level, 0 for DRAM
+    double read_bandwidth_[ROOFLINE_LEVEL_COUNT][ROOFLINE_SCOPE_COUNT];
+    double write_bandwidth_[ROOFLINE_LEVEL_COUNT][ROOFLINE_SCOPE_COUNT];
+    double scalar_flops_[ROOFLINE_SCOPE_COUNT];
+    double simd_flops_[ROOFLINE_SCOPE_COUNT];
+};
+
+char const* RooflineLevelName(RooflineLevel level);
+// NOTE: The innermost level whose capacity holds the working set.
+RooflineLevel RooflineLevelForBytes(const Roofline& roofline, uint64_t byte_count);
+bool SaveRoofline(const std::string& path, const Roofline& roofline);
+bool LoadRoofline(const std::string& path, Roofline& roofline);
+std::string GetRooflinePath();
+// NOTE: The calibration for this CPU from an earlier 'calibrate' run, nullptr if there is none.
+const Roofline* GetHostRoofline();
+int RunCalibration(int argc, char* argv[]);
@@ -0,0 +1,241 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+#include "shard.hpp"
+#include "haversine_processor.hpp"
+#include "incremental_cache.hpp"
+#include "json_parser.hpp"
+#include "perf_profiler.hpp"
+
+static void TwoSum(double a, double b, double& sum, double& error)
+{
+    sum = a + b;
+    double b_virtual = sum - a;
+    error = (a - (sum - b_virtual)) + (b - b_virtual);
+}
+
+static void Normalize(CompensatedSum& sum, double hi, double lo)
+{
+    sum.hi_ = hi + lo;
+    sum.lo_ = lo - (sum.hi_ - hi);
+}
+
+void AddToCompensatedSum(CompensatedSum& sum, double value)
+{
+    double hi, error;
+    TwoSum(sum.hi_, value, hi, error);
+    Normalize(sum, hi, error + sum.lo_);
+}
+
+void MergeCompensatedSums(CompensatedSum& sum, const CompensatedSum& other)
+{
+    double hi, error;
+    TwoSum(sum.hi_, other.hi_, hi, error);
+    Normalize(sum, hi, error + sum.lo_ + other.lo_);
+}
+
+double CompensatedSumValue(const CompensatedSum& sum)
+{
+    return sum.hi_ + sum.lo_;
+}
+
+double SumHaversineCompensated(const CustomVector(double)& haversine_vals)
+{
+    TimeBandwidth(__func__, haversine_vals.size() * sizeof(double));
+    CompensatedSum sum = {};
+    for (double val : haversine_vals)
+    {
+        AddToCompensatedSum(sum, val);
+    }
+    return CompensatedSumValue(sum);
+}
+
+bool ParseShardSpec(const char* text, ShardSpec& spec)
+{
+    spec = {};
+    char* rest = nullptr;
+    uint64_t first = strtoull(text, &rest, 10);
+    if (rest == text || (*rest != '/' && *rest != ':'))
+    {
+        return false;
+    }
+
+    char separator = *rest;
+    char* second_text = rest + 1;
+    uint64_t second = strtoull(second_text, &rest, 10);
+    if (rest == second_text || *rest != '\0')
+    {
+        return false;
+    }
+
+    if (separator == '/')
+    {
+        spec.index_ = first;
+        spec.count_ = second;
+        return first < second;
+    }
+    spec.begin_ = first;
+    spec.end_ = second;
+    return first < second;
+}
+
+// NOTE: size * index / count, split up so the product can't overflow on very large inputs.
+static uint64_t ShardBoundary(uint64_t size, uint64_t index, uint64_t count)
+{
+    return size / count * index + size % count * index / count;
+}
+
+bool ProcessShard(const std::string& filename, const ShardSpec& spec, ShardPartial& partial)
+{
+    partial = {};
+    partial.magic_ = SHARD_PARTIAL_MAGIC;
+    partial.version_ = SHARD_PARTIAL_VERSION;
+
+    // NOTE: The whole file is mapped, but only the header and this shard's range get paged in.
+    MappedFile file;
+    if (!MapPointsFile(filename, file))
+    {
+        return false;
+    }
+
+    const char* data = file.data_;
+    const char* end = data + file.size_;
+    const char* array = FindPointsArray(data, end);
+    if (!array)
+    {
+        UnmapPointsFile(file);
+        return false;
+    }
+
+    uint64_t begin_offset = spec.begin_;
+    uint64_t end_offset = spec.end_;
+    if (spec.count_)
+    {
+        begin_offset = ShardBoundary(file.size_, spec.index_, spec.count_);
+        end_offset = ShardBoundary(file.size_, spec.index_ + 1, spec.count_);
+    }
+    begin_offset = std::min(begin_offset, file.size_);
+    end_offset = std::min(end_offset, file.size_);
+
+    partial.file_size_ = file.size_;
+    partial.prefix_hash_ = HashBytes(data, array - data);
+    partial.begin_ = begin_offset;
+    partial.end_ = end_offset;
+
+    const char* pos = std::max(array, data + begin_offset);
+    const char* stop = data + end_offset;
+    CustomVector(Point) points;
+    if (pos < stop)
+    {
+        TimeBandwidth("ProcessJson shard", stop - pos);
+        ParsePointObjects(pos, stop, end, points);
+    }
+
+    CustomVector(double) haversine_vals;
+    ComputeHaversine(points, haversine_vals);
+    {
+        TimeBandwidth("Compensated sum", haversine_vals.size() * sizeof(double));
+        for (double val : haversine_vals)
+        {
+            AddToCompensatedSum(partial.sum_, val);
+        }
+    }
+    partial.point_count_ = points.size();
+
+    UnmapPointsFile(file);
+    return true;
+}
+
+bool WriteShardPartial(const std::string& path, const ShardPartial& partial)
+{
+    FILE* file = fopen(path.c_str(), "wb");
+    bool written = file && fwrite(&partial, sizeof(partial), 1, file) == 1;
+    if (file)
+    {
+        written = (fclose(file) == 0) && written;
+    }
+    if (!written)
+    {
+        std::cerr << "  Could not write partial result: " << path << std::endl;
+    }
+    return written;
+}
+
+bool ReadShardPartial(const std::string& path, ShardPartial& partial)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file)
+    {
+        std::cerr << "  Could not open partial result: " << path << std::endl;
+        return false;
+    }
+
+    bool read = fread(&partial, sizeof(partial), 1, file) == 1 &&
+                partial.magic_ == SHARD_PARTIAL_MAGIC && partial.version_ == SHARD_PARTIAL_VERSION;
+    fclose(file);
+    if (!read)
+    {
+        std::cerr << "  Not a partial result file: " << path << std::endl;
+    }
+    return read;
+}
+
+int RunMerge(int argc, char* argv[])
+{
+    if (argc == 0)
+    {
+        std::cerr << "merge needs at least one partial result file" << std::endl;
+        return 1;
+    }
+
+    std::vector<ShardPartial> partials(argc);
+    for (int arg_index = 0; arg_index < argc; ++arg_index)
+    {
+        if (!ReadShardPartial(argv[arg_index], partials[arg_index]))
+        {
+            return 1;
+        }
+    }
+
+    // NOTE: Merged in file order so the result doesn't depend on how the shells globbed the names.
+    std::sort(partials.begin(), partials.end(), [](const ShardPartial& a, const ShardPartial& b) { return a.begin_ < b.begin_; });
+
+    uint64_t covered = 0;
+    for (const ShardPartial& partial : partials)
+    {
+        if (partial.file_size_ != partials[0].file_size_ || partial.prefix_hash_ != partials[0].prefix_hash_)
+        {
+            std::cerr << "Partial results come from different input files" << std::endl;
+            return 1;
+        }
+        if (partial.begin_ != covered)
+        {
+            std::cerr << "Partial results " << (partial.begin_ > covered ? "leave a gap" : "overlap")
+                      << " at byte " << std::min(covered, partial.begin_) << std::endl;
+            return 1;
+        }
+        covered = partial.end_;
+    }
+    if (covered != partials[0].file_size_)
+    {
+        std::cerr << "Partial results stop at byte " << covered << " of " << partials[0].file_size_ << std::endl;
+        return 1;
+    }
+
+    uint64_t point_count = 0;
+    CompensatedSum sum = {};
+    for (const ShardPartial& partial : partials)
+    {
+        point_count += partial.point_count_;
+        MergeCompensatedSums(sum, partial.sum_);
+    }
+
+    std::cout << "File size: " << partials[0].file_size_ << " bytes" << std::endl;
+    std::cout << "Points: " << point_count << std::endl;
+    std::cout << "Shards: " << partials.size() << std::endl;
+    std::cout << std::fixed << std::setprecision(16) << "Haversine sum: " << CompensatedSumValue(sum) << std::endl;
+    return 0;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include "haversine_processor.hpp"
+
+#define SHARD_PARTIAL_MAGIC 0x50535648 // 'HVSP'
+#define SHARD_PARTIAL_VERSION 1
+
+// NOTE: An unevaluated sum hi_ + lo_ carrying about 106 bits of precision. The error left
+// after rounding is far below half an ulp of the total, so in practice partials merge to the
+// same double however the values were split, and --compensated gives that double for one run.
+// It isn't a correctly rounded sum, though: ties and near-ties can still go either way.
+struct CompensatedSum
+{
+    double hi_;
+    double lo_;
+};
+
+// NOTE: With count_ != 0, shard index_ of count_ equal byte ranges of the file; otherwise the
+// explicit range [begin_, end_). A shard owns every point object whose '{' lies in its range,
+// so adjacent shards snap to the same object boundary and nothing is dropped or counted twice.
+struct ShardSpec
+{
+    uint64_t index_;
+    uint64_t count_;
+    uint64_t begin_;
+    uint64_t end_;
+};
+
+struct ShardPartial
+{
+    uint32_t magic_;
+    uint32_t version_;
+    uint64_t file_size_;
+    uint64_t prefix_hash_; // hash of the bytes before the points array, to tell inputs apart
+    uint64_t begin_;       // byte range this shard was given, after resolving the spec
+    uint64_t end_;
+    uint64_t point_count_;
+    CompensatedSum sum_;
+};
+
+void AddToCompensatedSum(CompensatedSum& sum, double value);
+void MergeCompensatedSums(CompensatedSum& sum, const CompensatedSum& other);
+double CompensatedSumValue(const CompensatedSum& sum);
+double SumHaversineCompensated(const CustomVector(double)& haversine_vals);
+
+// NOTE: Accepts "I/N" for one of N equal shards or "B:E" for a byte range.
+bool ParseShardSpec(const char* text, ShardSpec& spec);
+bool ProcessShard(const std::string& filename, const ShardSpec& spec, ShardPartial& partial);
+bool WriteShardPartial(const std::string& path, const ShardPartial& partial);
+bool ReadShardPartial(const std::string& path, ShardPartial& partial);
+// NOTE: Combines the partial files named in argv, which must tile one input file exactly.
+int RunMerge(int argc, char* argv[]);
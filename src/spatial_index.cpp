@@ -0,0 +1,599 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <string_view>
+#include "spatial_index.hpp"
+#include "haversine_formula.hpp"
+#include "incremental_cache.hpp"
+#include "perf_profiler.hpp"
+#include "platform_metrics.hpp"
+#include "thread_pool.hpp"
+#include "timer_calibration.hpp"
+
+#define SPATIAL_BUILD_CHUNK (1 << 16)
+#define SPATIAL_QUERY_BATCH 64
+
+struct QueryPoint
+{
+    double axes_[3];
+    double lon_;
+    double lat_;
+};
+
+struct NodeRange
+{
+    uint64_t lo_;
+    uint64_t hi_;
+};
+
+static uint64_t NodeMedian(uint64_t lo, uint64_t hi)
+{
+    return lo + (hi - lo) / 2;
+}
+
+static void UnitVectorFromDegrees(double lon, double lat, double* axes)
+{
+    double lat_radians = RadiansFromDegrees(lat);
+    double lon_radians = RadiansFromDegrees(lon);
+    double cos_lat = cos(lat_radians);
+    axes[0] = cos_lat * cos(lon_radians);
+    axes[1] = cos_lat * sin(lon_radians);
+    axes[2] = sin(lat_radians);
+}
+
+static QueryPoint MakeQueryPoint(double lon, double lat)
+{
+    QueryPoint query;
+    UnitVectorFromDegrees(lon, lat, query.axes_);
+    query.lon_ = lon;
+    query.lat_ = lat;
+    return query;
+}
+
+// NOTE: Partitions order[lo, hi) around its median along the widest axis.
+static void SplitNode(const double* const* axes, uint32_t* order, uint8_t* split_axis, uint64_t lo, uint64_t hi)
+{
+    double min[3] = { 2, 2, 2 }, max[3] = { -2, -2, -2 };
+    for (uint64_t slot = lo; slot < hi; ++slot)
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            double value = axes[axis][order[slot]];
+            min[axis] = std::min(min[axis], value);
+            max[axis] = std::max(max[axis], value);
+        }
+    }
+
+    uint8_t widest = 0;
+    for (uint8_t axis = 1; axis < 3; ++axis)
+    {
+        if (max[axis] - min[axis] > max[widest] - min[widest]) widest = axis;
+    }
+
+    const double* coordinate = axes[widest];
+    uint64_t median = NodeMedian(lo, hi);
+    std::nth_element(order + lo, order + median, order + hi, [coordinate](uint32_t a, uint32_t b) { return coordinate[a] < coordinate[b]; });
+    split_axis[median] = widest;
+}
+
+static void BuildSubtree(const double* const* axes, uint32_t* order, uint8_t* split_axis, uint64_t lo, uint64_t hi)
+{
+    while (hi - lo > SPATIAL_INDEX_LEAF_SIZE)
+    {
+        SplitNode(axes, order, split_axis, lo, hi);
+        uint64_t median = NodeMedian(lo, hi);
+        BuildSubtree(axes, order, split_axis, lo, median);
+        lo = median + 1;
+    }
+}
+
+bool BuildSpatialIndex(const CustomVector(Point)& points, SpatialIndex& index)
+{
+    uint64_t point_count = points.size();
+    if (point_count > std::numeric_limits<uint32_t>::max())
+    {
+        std::cerr << "  Too many points for the spatial index: " << point_count << std::endl;
+        return false;
+    }
+    TimeBandwidth("Build spatial index", point_count * sizeof(Point));
+
+    CustomVector(double) unit_axes[3];
+    CustomVector(uint32_t) order(point_count);
+    for (CustomVector(double)& axis : unit_axes) axis.resize(point_count);
+    index.point_count_ = point_count;
+    index.split_axis_.assign(point_count, 0);
+
+    uint64_t chunk_count = (point_count + SPATIAL_BUILD_CHUNK - 1) / SPATIAL_BUILD_CHUNK;
+    RunJobs(g_thread_pool, chunk_count, [&](uint64_t chunk_index)
+    {
+        uint64_t end = std::min<uint64_t>((chunk_index + 1) * SPATIAL_BUILD_CHUNK, point_count);
+        for (uint64_t point_index = chunk_index * SPATIAL_BUILD_CHUNK; point_index < end; ++point_index)
+        {
+            double axes[3];
+            UnitVectorFromDegrees(points[point_index].x0, points[point_index].y0, axes);
+            for (int axis = 0; axis < 3; ++axis) unit_axes[axis][point_index] = axes[axis];
+            order[point_index] = (uint32_t)point_index;
+        }
+    });
+
+    // NOTE: Each level's nodes are split in parallel until there are enough subtrees to keep
+    // every thread busy, then the subtrees are finished one job each.
+    const double* axes[3] = { unit_axes[0].data(), unit_axes[1].data(), unit_axes[2].data() };
+    uint32_t* order_data = order.data();
+    uint8_t* split_axis = index.split_axis_.data();
+    std::vector<NodeRange> level;
+    if (point_count > SPATIAL_INDEX_LEAF_SIZE) level.push_back({ 0, point_count });
+    uint64_t subtree_target = 8ull * GetThreadCount(g_thread_pool);
+    while (!level.empty() && level.size() < subtree_target)
+    {
+        RunJobs(g_thread_pool, level.size(), [&](uint64_t node_index)
+        {
+            SplitNode(axes, order_data, split_axis, level[node_index].lo_, level[node_index].hi_);
+        });
+
+        std::vector<NodeRange> next;
+        for (const NodeRange& node : level)
+        {
+            uint64_t median = NodeMedian(node.lo_, node.hi_);
+            if (median - node.lo_ > SPATIAL_INDEX_LEAF_SIZE) next.push_back({ node.lo_, median });
+            if (node.hi_ - (median + 1) > SPATIAL_INDEX_LEAF_SIZE) next.push_back({ median + 1, node.hi_ });
+        }
+        level.swap(next);
+    }
+    RunJobs(g_thread_pool, level.size(), [&](uint64_t node_index)
+    {
+        BuildSubtree(axes, order_data, split_axis, level[node_index].lo_, level[node_index].hi_);
+    });
+
+    index.x_.resize(point_count);
+    index.y_.resize(point_count);
+    index.z_.resize(point_count);
+    index.lon_.resize(point_count);
+    index.lat_.resize(point_count);
+    index.point_index_.resize(point_count);
+    RunJobs(g_thread_pool, chunk_count, [&](uint64_t chunk_index)
+    {
+        uint64_t end = std::min<uint64_t>((chunk_index + 1) * SPATIAL_BUILD_CHUNK, point_count);
+        for (uint64_t slot = chunk_index * SPATIAL_BUILD_CHUNK; slot < end; ++slot)
+        {
+            uint32_t point_index = order[slot];
+            index.x_[slot] = axes[0][point_index];
+            index.y_[slot] = axes[1][point_index];
+            index.z_[slot] = axes[2][point_index];
+            index.lon_[slot] = points[point_index].x0;
+            index.lat_[slot] = points[point_index].y0;
+            index.point_index_[slot] = point_index;
+        }
+    });
+    return true;
+}
+
+template <typename Vector>
+static bool WriteArray(FILE* file, const Vector& values)
+{
+    return fwrite(values.data(), sizeof(values[0]), values.size(), file) == values.size();
+}
+
+template <typename Vector>
+static bool ReadArray(FILE* file, Vector& values, uint64_t count)
+{
+    values.resize(count);
+    return fread(values.data(), sizeof(values[0]), count, file) == count;
+}
+
+bool SaveSpatialIndex(const std::string& path, const SpatialIndex& index, uint64_t source_size, uint64_t source_hash)
+{
+    TimeFunction;
+    SpatialIndexFileHeader header = { SPATIAL_INDEX_MAGIC, SPATIAL_INDEX_VERSION, source_size, source_hash, index.point_count_ };
+
+    std::string temp_path = path + ".tmp";
+    FILE* file = fopen(temp_path.c_str(), "wb");
+    bool written = file && fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   WriteArray(file, index.x_) && WriteArray(file, index.y_) && WriteArray(file, index.z_) &&
+                   WriteArray(file, index.lon_) && WriteArray(file, index.lat_) &&
+                   WriteArray(file, index.point_index_) && WriteArray(file, index.split_axis_);
+    if (file)
+    {
+        written = (fclose(file) == 0) && written;
+    }
+
+    if (!written || rename(temp_path.c_str(), path.c_str()) != 0)
+    {
+        std::cerr << "  Could not write spatial index: " << path << std::endl;
+        remove(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool LoadSpatialIndex(const std::string& path, SpatialIndex& index, uint64_t source_size, uint64_t source_hash)
+{
+    TimeFunction;
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file)
+    {
+        return false;
+    }
+
+    SpatialIndexFileHeader header = {};
+    uint64_t count = 0;
+    bool loaded = fread(&header, sizeof(header), 1, file) == 1 &&
+                  header.magic_ == SPATIAL_INDEX_MAGIC && header.version_ == SPATIAL_INDEX_VERSION &&
+                  header.source_size_ == source_size && header.source_hash_ == source_hash;
+    if (loaded)
+    {
+        count = header.point_count_;
+        loaded = ReadArray(file, index.x_, count) && ReadArray(file, index.y_, count) && ReadArray(file, index.z_, count) &&
+                 ReadArray(file, index.lon_, count) && ReadArray(file, index.lat_, count) &&
+                 ReadArray(file, index.point_index_, count) && ReadArray(file, index.split_axis_, count);
+        AddProcessedBytes(count * (5 * sizeof(double) + sizeof(uint32_t) + sizeof(uint8_t)));
+    }
+    fclose(file);
+    index.point_count_ = loaded ? count : 0;
+    return loaded;
+}
+
+static double SlotChordSquared(const SpatialIndex& index, const QueryPoint& query, uint64_t slot)
+{
+    double dx = query.axes_[0] - index.x_[slot];
+    double dy = query.axes_[1] - index.y_[slot];
+    double dz = query.axes_[2] - index.z_[slot];
+    return dx*dx + dy*dy + dz*dz;
+}
+
+static double SlotAxis(const SpatialIndex& index, uint64_t slot, uint8_t axis)
+{
+    return axis == 0 ? index.x_[slot] : (axis == 1 ? index.y_[slot] : index.z_[slot]);
+}
+
+static double SlotDistance(const SpatialIndex& index, const QueryPoint& query, uint64_t slot)
+{
+    return ReferenceHaversine(query.lon_, query.lat_, index.lon_[slot], index.lat_[slot], EARTH_RAD);
+}
+
+struct RadiusSearch
+{
+    const SpatialIndex& index_;
+    QueryPoint query_;
+    double radius_;
+    double chord_squared_limit_;
+    std::vector<Neighbour>& hits_;
+};
+
+static void TestRadiusSlot(RadiusSearch& search, uint64_t slot)
+{
+    if (SlotChordSquared(search.index_, search.query_, slot) <= search.chord_squared_limit_)
+    {
+        double distance = SlotDistance(search.index_, search.query_, slot);
+        if (distance <= search.radius_)
+        {
+            search.hits_.push_back({ search.index_.point_index_[slot], distance });
+        }
+    }
+}
+
+static void SearchRadius(RadiusSearch& search, uint64_t lo, uint64_t hi)
+{
+    while (hi - lo > SPATIAL_INDEX_LEAF_SIZE)
+    {
+        uint64_t median = NodeMedian(lo, hi);
+        TestRadiusSlot(search, median);
+
+        double difference = search.query_.axes_[search.index_.split_axis_[median]] - SlotAxis(search.index_, median, search.index_.split_axis_[median]);
+        bool left_is_near = difference <= 0;
+        if (difference * difference <= search.chord_squared_limit_)
+        {
+            if (left_is_near) SearchRadius(search, median + 1, hi);
+            else SearchRadius(search, lo, median);
+        }
+        if (left_is_near) hi = median;
+        else lo = median + 1;
+    }
+    for (uint64_t slot = lo; slot < hi; ++slot)
+    {
+        TestRadiusSlot(search, slot);
+    }
+}
+
+struct NearestSearch
+{
+    const SpatialIndex& index_;
+    QueryPoint query_;
+    uint32_t k_;
+    std::vector<std::pair<double, uint64_t>> heap_; // max-heap of (chord squared, slot)
+};
+
+static double NearestBound(const NearestSearch& search)
+{
+    return search.heap_.size() < search.k_ ? std::numeric_limits<double>::infinity() : search.heap_.front().first;
+}
+
+static void TestNearestSlot(NearestSearch& search, uint64_t slot)
+{
+    double chord_squared = SlotChordSquared(search.index_, search.query_, slot);
+    if (search.heap_.size() < search.k_)
+    {
+        search.heap_.push_back({ chord_squared, slot });
+        std::push_heap(search.heap_.begin(), search.heap_.end());
+    }
+    else if (chord_squared < search.heap_.front().first)
+    {
+        std::pop_heap(search.heap_.begin(), search.heap_.end());
+        search.heap_.back() = { chord_squared, slot };
+        std::push_heap(search.heap_.begin(), search.heap_.end());
+    }
+}
+
+static void SearchNearest(NearestSearch& search, uint64_t lo, uint64_t hi)
+{
+    if (hi - lo <= SPATIAL_INDEX_LEAF_SIZE)
+    {
+        for (uint64_t slot = lo; slot < hi; ++slot)
+        {
+            TestNearestSlot(search, slot);
+        }
+        return;
+    }
+
+    uint64_t median = NodeMedian(lo, hi);
+    TestNearestSlot(search, median);
+
+    double difference = search.query_.axes_[search.index_.split_axis_[median]] - SlotAxis(search.index_, median, search.index_.split_axis_[median]);
+    bool left_is_near = difference <= 0;
+    if (left_is_near) SearchNearest(search, lo, median);
+    else SearchNearest(search, median + 1, hi);
+
+    // NOTE: The bound usually shrank while searching the near side.
+    if (difference * difference <= NearestBound(search))
+    {
+        if (left_is_near) SearchNearest(search, median + 1, hi);
+        else SearchNearest(search, lo, median);
+    }
+}
+
+static bool NeighbourLess(const Neighbour& a, const Neighbour& b)
+{
+    return a.distance_ < b.distance_ || (a.distance_ == b.distance_ && a.point_index_ < b.point_index_);
+}
+
+template <typename Search>
+static void RunBatchedQueries(uint64_t query_count, QueryResults& results, Search search)
+{
+    uint64_t job_count = (query_count + SPATIAL_QUERY_BATCH - 1) / SPATIAL_QUERY_BATCH;
+    std::vector<std::vector<Neighbour>> job_neighbours(job_count);
+    results.offsets_.assign(query_count + 1, 0);
+    RunJobs(g_thread_pool, job_count, [&](uint64_t job_index)
+    {
+        std::vector<Neighbour>& neighbours = job_neighbours[job_index];
+        uint64_t end = std::min<uint64_t>((job_index + 1) * SPATIAL_QUERY_BATCH, query_count);
+        for (uint64_t query_index = job_index * SPATIAL_QUERY_BATCH; query_index < end; ++query_index)
+        {
+            uint64_t first = neighbours.size();
+            search(query_index, neighbours);
+            results.offsets_[query_index + 1] = neighbours.size() - first;
+        }
+    });
+
+    for (uint64_t query_index = 0; query_index < query_count; ++query_index)
+    {
+        results.offsets_[query_index + 1] += results.offsets_[query_index];
+    }
+    results.neighbours_.clear();
+    results.neighbours_.reserve(results.offsets_[query_count]);
+    for (const std::vector<Neighbour>& neighbours : job_neighbours)
+    {
+        results.neighbours_.insert(results.neighbours_.end(), neighbours.begin(), neighbours.end());
+    }
+}
+
+void RadiusQuery(const SpatialIndex& index, const double* query_lon, const double* query_lat, uint64_t query_count,
+                 double radius, QueryResults& results)
+{
+    TimeBandwidth("Radius query", query_count * 2 * sizeof(double));
+
+    // NOTE: Chords are compared with a little slack; the exact test is the haversine refinement.
+    double half_angle = std::min(radius / EARTH_RAD, 3.14159265358979323846) / 2.0;
+    double chord = 2.0 * sin(half_angle);
+    double chord_squared_limit = chord * chord * (1.0 + 1e-9) + 1e-15;
+    RunBatchedQueries(query_count, results, [&](uint64_t query_index, std::vector<Neighbour>& hits)
+    {
+        uint64_t first = hits.size();
+        RadiusSearch search = { index, MakeQueryPoint(query_lon[query_index], query_lat[query_index]), radius, chord_squared_limit, hits };
+        if (index.point_count_) SearchRadius(search, 0, index.point_count_);
+        std::sort(hits.begin() + first, hits.end(), [](const Neighbour& a, const Neighbour& b) { return a.point_index_ < b.point_index_; });
+    });
+}
+
+void NearestQuery(const SpatialIndex& index, const double* query_lon, const double* query_lat, uint64_t query_count,
+                  uint32_t k, QueryResults& results)
+{
+    TimeBandwidth("Nearest query", query_count * 2 * sizeof(double));
+    RunBatchedQueries(query_count, results, [&](uint64_t query_index, std::vector<Neighbour>& neighbours)
+    {
+        NearestSearch search = { index, MakeQueryPoint(query_lon[query_index], query_lat[query_index]), k, {} };
+        search.heap_.reserve(k);
+        if (index.point_count_ && k) SearchNearest(search, 0, index.point_count_);
+
+        uint64_t first = neighbours.size();
+        for (const std::pair<double, uint64_t>& entry : search.heap_)
+        {
+            neighbours.push_back({ index.point_index_[entry.second], SlotDistance(index, search.query_, entry.second) });
+        }
+        std::sort(neighbours.begin() + first, neighbours.end(), NeighbourLess);
+    });
+}
+
+static void BruteForceRadius(const CustomVector(Point)& points, const double* query_lon, const double* query_lat, uint64_t query_count,
+                             double radius, QueryResults& results)
+{
+    TimeFlops("Brute force radius", query_count * points.size() * sizeof(Point), query_count * points.size() * HAVERSINE_NOMINAL_FLOPS);
+    RunBatchedQueries(query_count, results, [&](uint64_t query_index, std::vector<Neighbour>& hits)
+    {
+        for (uint64_t point_index = 0; point_index < points.size(); ++point_index)
+        {
+            double distance = ReferenceHaversine(query_lon[query_index], query_lat[query_index], points[point_index].x0, points[point_index].y0, EARTH_RAD);
+            if (distance <= radius)
+            {
+                hits.push_back({ (uint32_t)point_index, distance });
+            }
+        }
+    });
+}
+
+static void BruteForceNearest(const CustomVector(Point)& points, const double* query_lon, const double* query_lat, uint64_t query_count,
+                              uint32_t k, QueryResults& results)
+{
+    TimeFlops("Brute force nearest", query_count * points.size() * sizeof(Point), query_count * points.size() * HAVERSINE_NOMINAL_FLOPS);
+    RunBatchedQueries(query_count, results, [&](uint64_t query_index, std::vector<Neighbour>& neighbours)
+    {
+        uint64_t first = neighbours.size();
+        for (uint64_t point_index = 0; point_index < points.size(); ++point_index)
+        {
+            Neighbour candidate = { (uint32_t)point_index, ReferenceHaversine(query_lon[query_index], query_lat[query_index],
+                                                                              points[point_index].x0, points[point_index].y0, EARTH_RAD) };
+            if (neighbours.size() - first < k)
+            {
+                neighbours.push_back(candidate);
+                std::push_heap(neighbours.begin() + first, neighbours.end(), NeighbourLess);
+            }
+            else if (k && NeighbourLess(candidate, neighbours[first]))
+            {
+                std::pop_heap(neighbours.begin() + first, neighbours.end(), NeighbourLess);
+                neighbours.back() = candidate;
+                std::push_heap(neighbours.begin() + first, neighbours.end(), NeighbourLess);
+            }
+        }
+        std::sort_heap(neighbours.begin() + first, neighbours.end(), NeighbourLess);
+    });
+}
+
+// NOTE: Counts the queries among the first query_count whose neighbours differ. Nearest
+// neighbours are compared by distance, so ties at the k-th place don't count as a mismatch.
+static uint64_t CountMismatches(const QueryResults& a, const QueryResults& b, uint64_t query_count, bool by_distance)
+{
+    uint64_t mismatch_count = 0;
+    for (uint64_t query_index = 0; query_index < query_count; ++query_index)
+    {
+        uint64_t a_count = a.offsets_[query_index + 1] - a.offsets_[query_index];
+        uint64_t b_count = b.offsets_[query_index + 1] - b.offsets_[query_index];
+        bool same = a_count == b_count;
+        for (uint64_t hit = 0; same && hit < a_count; ++hit)
+        {
+            const Neighbour& x = a.neighbours_[a.offsets_[query_index] + hit];
+            const Neighbour& y = b.neighbours_[b.offsets_[query_index] + hit];
+            same = by_distance ? std::fabs(x.distance_ - y.distance_) <= 1e-9 * std::max(1.0, y.distance_) : x.point_index_ == y.point_index_;
+        }
+        mismatch_count += !same;
+    }
+    return mismatch_count;
+}
+
+static double MillisecondsSince(uint64_t start)
+{
+    return 1000.0 * (double)(ReadCPUTimer() - start) / (double)GetCPUTimerFreq();
+}
+
+int RunSpatialIndex(int argc, char* argv[])
+{
+    const char* filename = nullptr;
+    double radius = 50.0;
+    uint32_t k = 10;
+    uint64_t query_count = 10000;
+    uint64_t brute_force_count = 0;
+    bool rebuild = false;
+    for (int arg_index = 0; arg_index < argc; ++arg_index)
+    {
+        std::string_view arg = argv[arg_index];
+        if (arg == "--radius" && arg_index + 1 < argc) radius = strtod(argv[++arg_index], nullptr);
+        else if (arg == "--knn" && arg_index + 1 < argc) k = (uint32_t)strtoul(argv[++arg_index], nullptr, 10);
+        else if (arg == "--queries" && arg_index + 1 < argc) query_count = strtoull(argv[++arg_index], nullptr, 10);
+        else if (arg == "--brute-force" && arg_index + 1 < argc) brute_force_count = strtoull(argv[++arg_index], nullptr, 10);
+        else if (arg == "--rebuild") rebuild = true;
+        else filename = argv[arg_index];
+    }
+    if (!filename)
+    {
+        std::cerr << "      Usage: index <filename.json> [--radius KM] [--knn K] [--queries N] [--brute-force N] [--rebuild]" << std::endl;
+        return 1;
+    }
+
+    CustomVector(char) json;
+    uint64_t file_size = ReadPointsJson(filename, json);
+    if (file_size == 0)
+    {
+        return 1;
+    }
+    CustomVector(Point) points;
+    ProcessJson(json.data(), file_size, points);
+    uint64_t source_hash = 0;
+    {
+        TimeBandwidth("Hash source", file_size);
+        source_hash = HashBytes(json.data(), file_size);
+    }
+    CustomVector(char)().swap(json);
+
+    // NOTE: The first point of every pair is indexed, the second points of the first
+    // query_count pairs are the queries.
+    SpatialIndex index;
+    std::string index_path = std::string(filename) + SPATIAL_INDEX_SUFFIX;
+    uint64_t start = ReadCPUTimer();
+    bool loaded = !rebuild && LoadSpatialIndex(index_path, index, file_size, source_hash);
+    if (!loaded)
+    {
+        if (!BuildSpatialIndex(points, index))
+        {
+            return 1;
+        }
+        SaveSpatialIndex(index_path, index, file_size, source_hash);
+    }
+    double index_ms = MillisecondsSince(start);
+
+    query_count = std::min<uint64_t>(query_count, points.size());
+    brute_force_count = std::min(brute_force_count, query_count);
+    std::vector<double> query_lon(query_count), query_lat(query_count);
+    for (uint64_t query_index = 0; query_index < query_count; ++query_index)
+    {
+        query_lon[query_index] = points[query_index].x1;
+        query_lat[query_index] = points[query_index].y1;
+    }
+
+    QueryResults radius_results, nearest_results;
+    start = ReadCPUTimer();
+    RadiusQuery(index, query_lon.data(), query_lat.data(), query_count, radius, radius_results);
+    double radius_ms = MillisecondsSince(start);
+    start = ReadCPUTimer();
+    NearestQuery(index, query_lon.data(), query_lat.data(), query_count, k, nearest_results);
+    double nearest_ms = MillisecondsSince(start);
+
+    printf("Points: %llu\n", (unsigned long long)points.size());
+    printf("Index: %s in %.2fms (%s)\n", loaded ? "loaded" : "built", index_ms, index_path.c_str());
+    printf("Radius %.3fkm: %llu queries, %llu hits, %.3fus/query\n", radius, (unsigned long long)query_count,
+           (unsigned long long)radius_results.neighbours_.size(), query_count ? 1000.0 * radius_ms / (double)query_count : 0.0);
+    printf("Nearest %u: %llu queries, %.3fus/query\n", k, (unsigned long long)query_count,
+           query_count ? 1000.0 * nearest_ms / (double)query_count : 0.0);
+
+    if (brute_force_count)
+    {
+        QueryResults brute_radius, brute_nearest;
+        start = ReadCPUTimer();
+        BruteForceRadius(points, query_lon.data(), query_lat.data(), brute_force_count, radius, brute_radius);
+        double brute_radius_ms = MillisecondsSince(start);
+        start = ReadCPUTimer();
+        BruteForceNearest(points, query_lon.data(), query_lat.data(), brute_force_count, k, brute_nearest);
+        double brute_nearest_ms = MillisecondsSince(start);
+
+        double per_query_radius = 1000.0 * brute_radius_ms / (double)brute_force_count;
+        double per_query_nearest = 1000.0 * brute_nearest_ms / (double)brute_force_count;
+        printf("Brute force on the first %llu queries:\n", (unsigned long long)brute_force_count);
+        printf("  Radius: %.3fus/query, index is %.1fx faster, %llu mismatched queries\n", per_query_radius,
+               per_query_radius / std::max(1e-9, 1000.0 * radius_ms / (double)query_count),
+               (unsigned long long)CountMismatches(radius_results, brute_radius, brute_force_count, false));
+        printf("  Nearest: %.3fus/query, index is %.1fx faster, %llu mismatched queries\n", per_query_nearest,
+               per_query_nearest / std::max(1e-9, 1000.0 * nearest_ms / (double)query_count),
+               (unsigned long long)CountMismatches(nearest_results, brute_nearest, brute_force_count, true));
+    }
+    return 0;
+}
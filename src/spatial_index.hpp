@@ -0,0 +1,60 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "haversine_processor.hpp"
+
+#define SPATIAL_INDEX_MAGIC 0x58495648 // 'HVIX'
+#define SPATIAL_INDEX_VERSION 1
+#define SPATIAL_INDEX_SUFFIX ".hvidx"
+#define SPATIAL_INDEX_LEAF_SIZE 16
+
+// NOTE: An implicit k-d tree over the points' 3-D unit vectors. Slots [lo, hi) form a node
+// whose median (lo + hi) / 2 splits the rest along split_axis_[median]; ranges of at most
+// SPATIAL_INDEX_LEAF_SIZE are leaves. Chord length orders pairs exactly like great-circle
+// distance, so the tree prunes on chords and ReferenceHaversine only refines survivors.
+struct SpatialIndex
+{
+    uint64_t point_count_;
+    CustomVector(double) x_;             // unit vectors, in tree order
+    CustomVector(double) y_;
+    CustomVector(double) z_;
+    CustomVector(double) lon_;           // degrees, in tree order, for the exact distance
+    CustomVector(double) lat_;
+    CustomVector(uint32_t) point_index_; // original position of each slot
+    CustomVector(uint8_t) split_axis_;
+};
+
+struct SpatialIndexFileHeader
+{
+    uint32_t magic_;
+    uint32_t version_;
+    uint64_t source_size_; // size and hash of the JSON the index was built from
+    uint64_t source_hash_;
+    uint64_t point_count_;
+};
+
+struct Neighbour
+{
+    uint32_t point_index_;
+    double distance_;
+};
+
+// NOTE: Query q's neighbours are neighbours_[offsets_[q], offsets_[q + 1]).
+struct QueryResults
+{
+    std::vector<uint64_t> offsets_;
+    std::vector<Neighbour> neighbours_;
+};
+
+// NOTE: Indexes the first point of every pair, in parallel below the top few levels.
+bool BuildSpatialIndex(const CustomVector(Point)& points, SpatialIndex& index);
+bool SaveSpatialIndex(const std::string& path, const SpatialIndex& index, uint64_t source_size, uint64_t source_hash);
+bool LoadSpatialIndex(const std::string& path, SpatialIndex& index, uint64_t source_size, uint64_t source_hash);
+// NOTE: Batched queries, split across the thread pool. Radius hits are in input order (by
+// point index), nearest neighbours closest first; both report ReferenceHaversine distances in km.
+void RadiusQuery(const SpatialIndex& index, const double* query_lon, const double* query_lat, uint64_t query_count,
+                 double radius, QueryResults& results);
+void NearestQuery(const SpatialIndex& index, const double* query_lon, const double* query_lat, uint64_t query_count,
+                  uint32_t k, QueryResults& results);
+int RunSpatialIndex(int argc, char* argv[]);
@@ -0,0 +1,164 @@
+#include "thread_pool.hpp"
+
+ThreadPool g_thread_pool;
+
+static void FinishJob(ThreadPool& pool)
+{
+    if (pool.jobs_done_.fetch_add(1) + 1 == pool.job_count_)
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex_);
+        pool.work_done_.notify_all();
+    }
+}
+
+bool RunOneJob(ThreadPool& pool)
+{
+    uint64_t job_index = pool.next_job_.fetch_add(1);
+    if (job_index >= pool.job_count_)
+    {
+        return false;
+    }
+
+    pool.job_(job_index);
+    FinishJob(pool);
+    return true;
+}
+
+static void RunAvailableJobs(ThreadPool& pool)
+{
+    while (RunOneJob(pool))
+    {
+    }
+}
+
+static void WorkerLoop(ThreadPool* pool, uint32_t worker_index)
+{
+    uint64_t seen_generation = 0;
+    std::unique_lock<std::mutex> lock(pool->mutex_);
+    for (;;)
+    {
+        pool->work_ready_.wait(lock, [&] { return pool->stopping_ || pool->generation_ != seen_generation; });
+        if (pool->stopping_)
+        {
+            break;
+        }
+
+        seen_generation = pool->generation_;
+        ++pool->active_workers_;
+        bool per_thread = pool->per_thread_;
+        lock.unlock();
+
+        if (per_thread)
+        {
+            pool->job_(worker_index);
+            FinishJob(*pool);
+        }
+        else
+        {
+            RunAvailableJobs(*pool);
+        }
+
+        lock.lock();
+        --pool->active_workers_;
+        pool->work_done_.notify_all();
+    }
+}
+
+void StartThreadPool(ThreadPool& pool, uint32_t thread_count)
+{
+    StopThreadPool(pool);
+
+    if (thread_count == 0)
+    {
+        thread_count = std::thread::hardware_concurrency();
+    }
+    if (thread_count == 0)
+    {
+        thread_count = 1;
+    }
+
+    pool.job_count_ = 0;
+    pool.next_job_ = 0;
+    pool.jobs_done_ = 0;
+    pool.generation_ = 0;
+    pool.active_workers_ = 0;
+    pool.per_thread_ = false;
+    pool.stopping_ = false;
+    for (uint32_t worker_index = 1; worker_index < thread_count; ++worker_index)
+    {
+        pool.workers_.emplace_back(WorkerLoop, &pool, worker_index);
+    }
+}
+
+void StopThreadPool(ThreadPool& pool)
+{
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex_);
+        pool.stopping_ = true;
+    }
+    pool.work_ready_.notify_all();
+
+    for (auto& worker : pool.workers_)
+    {
+        worker.join();
+    }
+    pool.workers_.clear();
+}
+
+uint32_t GetThreadCount(ThreadPool& pool)
+{
+    return static_cast<uint32_t>(pool.workers_.size()) + 1;
+}
+
+void RunJobsAsync(ThreadPool& pool, uint64_t job_count, JobFunction job)
+{
+    std::unique_lock<std::mutex> lock(pool.mutex_);
+    // NOTE: A worker that woke up late for the previous wave may still be draining the job
+    // counter, so it has to leave before the job state can be swapped out underneath it.
+    pool.work_done_.wait(lock, [&] { return pool.active_workers_ == 0; });
+    pool.job_ = std::move(job);
+    pool.job_count_ = job_count;
+    pool.next_job_ = 0;
+    pool.jobs_done_ = 0;
+    pool.per_thread_ = false;
+    ++pool.generation_;
+    pool.work_ready_.notify_all();
+}
+
+void WaitForJobs(ThreadPool& pool)
+{
+    RunAvailableJobs(pool);
+
+    std::unique_lock<std::mutex> lock(pool.mutex_);
+    pool.work_done_.wait(lock, [&] { return pool.jobs_done_ == pool.job_count_ && pool.active_workers_ == 0; });
+    pool.job_ = nullptr;
+}
+
+void RunJobs(ThreadPool& pool, uint64_t job_count, JobFunction job)
+{
+    RunJobsAsync(pool, job_count, std::move(job));
+    WaitForJobs(pool);
+}
+
+void RunOnEachThread(ThreadPool& pool, JobFunction job)
+{
+    {
+        std::unique_lock<std::mutex> lock(pool.mutex_);
+        pool.work_done_.wait(lock, [&] { return pool.active_workers_ == 0; });
+        pool.job_ = std::move(job);
+        pool.job_count_ = GetThreadCount(pool);
+        // NOTE: An exhausted queue, so nothing that helps out through RunOneJob steals a job.
+        pool.next_job_ = pool.job_count_;
+        pool.jobs_done_ = 0;
+        pool.per_thread_ = true;
+        ++pool.generation_;
+        pool.work_ready_.notify_all();
+    }
+
+    pool.job_(0);
+    FinishJob(pool);
+
+    std::unique_lock<std::mutex> lock(pool.mutex_);
+    pool.work_done_.wait(lock, [&] { return pool.jobs_done_ == pool.job_count_ && pool.active_workers_ == 0; });
+    pool.job_ = nullptr;
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using JobFunction = std::function<void(uint64_t job_index)>;
+
+struct ThreadPool
+{
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable work_ready_;
+    std::condition_variable work_done_;
+
+    JobFunction job_;
+    uint64_t job_count_;
+    std::atomic<uint64_t> next_job_;
+    std::atomic<uint64_t> jobs_done_;
+    uint64_t generation_;
+    uint32_t active_workers_;
+    bool per_thread_; // the current wave is RunOnEachThread's, not a shared job queue
+    bool stopping_;
+};
+
+extern ThreadPool g_thread_pool;
+
+// NOTE: thread_count includes the calling thread, which helps out in WaitForJobs,
+// so a pool started with a single thread has no workers and runs everything inline.
+void StartThreadPool(ThreadPool& pool, uint32_t thread_count);
+void StopThreadPool(ThreadPool& pool);
+uint32_t GetThreadCount(ThreadPool& pool);
+void RunJobsAsync(ThreadPool& pool, uint64_t job_count, JobFunction job);
+void WaitForJobs(ThreadPool& pool);
+// NOTE: Lets a thread that is waiting on a particular job's result help out instead of
+// blocking. Returns false once every job of the current wave has been handed out.
+bool RunOneJob(ThreadPool& pool);
+void RunJobs(ThreadPool& pool, uint64_t job_count, JobFunction job);
+// NOTE: Runs job exactly once on every pool thread, with that thread's fixed index (0 is the
+// caller, workers keep theirs for the life of the pool), and returns when all are done.
+// For per-thread measurements, where a shared queue could hand one thread several jobs.
+void RunOnEachThread(ThreadPool& pool, JobFunction job);
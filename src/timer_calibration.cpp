@@ -0,0 +1,189 @@
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "timer_calibration.hpp"
+#include "platform_metrics.hpp"
+
+#define TIMER_CACHE_FILE_NAME "timer_freq"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+
+static bool ReadCPUID(uint32_t leaf, uint32_t regs[4])
+{
+    #if _WIN32
+    int info[4];
+    __cpuid(info, leaf & 0xF0000000); // max leaf of the range this leaf belongs to
+    if ((uint32_t)info[0] < leaf) return false;
+    __cpuid(info, leaf);
+    for (int reg_index = 0; reg_index < 4; ++reg_index) regs[reg_index] = (uint32_t)info[reg_index];
+    return true;
+    #else
+    // NOTE: __get_cpuid only knows the basic and extended ranges and rejects hypervisor
+    // leaves outright, so check the range's max leaf by hand like the Windows path does.
+    uint32_t max_leaf, unused;
+    __cpuid(leaf & 0xF0000000, max_leaf, unused, unused, unused);
+    if (max_leaf < leaf) return false;
+    __cpuid(leaf, regs[0], regs[1], regs[2], regs[3]);
+    return true;
+    #endif
+}
+
+static uint64_t ReadCPUIDTimerFreq()
+{
+    // NOTE: Leaf 0x15 gives TSC/crystal as EBX/EAX and the crystal frequency in ECX. Some
+    // parts leave ECX zero, in which case the SDM says to derive the crystal from the
+    // 0x16 base frequency instead.
+    uint32_t tsc_leaf[4] = {};
+    if (!ReadCPUID(0x15, tsc_leaf) || tsc_leaf[0] == 0 || tsc_leaf[1] == 0)
+    {
+        return 0;
+    }
+
+    uint64_t crystal_hz = tsc_leaf[2];
+    if (crystal_hz)
+    {
+        return crystal_hz * tsc_leaf[1] / tsc_leaf[0];
+    }
+
+    // crystal = base * EAX/EBX, so the TSC lands exactly on the 0x16 base frequency
+    uint32_t freq_leaf[4] = {};
+    if (ReadCPUID(0x16, freq_leaf) && freq_leaf[0])
+    {
+        return (uint64_t)freq_leaf[0] * 1000000;
+    }
+    return 0;
+}
+
+static uint64_t ReadHypervisorTimerFreq()
+{
+    uint32_t regs[4] = {};
+    if (!ReadCPUID(1, regs) || !(regs[2] & (1u << 31)))
+    {
+        return 0; // not running under a hypervisor
+    }
+
+    // NOTE: Leaf 0x40000010 is the VMware-style timing leaf that KVM and others also
+    // expose, with the guest TSC frequency in kHz in EAX.
+    uint32_t timing[4] = {};
+    if (!ReadCPUID(0x40000010, timing))
+    {
+        return 0;
+    }
+    return (uint64_t)timing[0] * 1000;
+}
+
+#endif
+
+static std::string GetTimerCacheKey()
+{
+    std::string boot_id = GetBootID();
+    if (boot_id.empty())
+    {
+        return ""; // without a boot identity a stale measurement can't be detected
+    }
+    return GetCPUSignature() + " " + boot_id;
+}
+
+static uint64_t ReadCachedTimerFreq(const std::string& key)
+{
+    std::string directory = GetCacheDirectory();
+    if (key.empty() || directory.empty())
+    {
+        return 0;
+    }
+
+    std::ifstream cache(std::filesystem::path(directory) / TIMER_CACHE_FILE_NAME);
+    std::string line;
+    while (std::getline(cache, line))
+    {
+        if (line.size() > key.size() && line.compare(0, key.size(), key) == 0 && line[key.size()] == ' ')
+        {
+            return strtoull(line.c_str() + key.size() + 1, nullptr, 10);
+        }
+    }
+    return 0;
+}
+
+static void WriteCachedTimerFreq(const std::string& key, uint64_t freq)
+{
+    std::string directory = GetCacheDirectory();
+    if (key.empty() || directory.empty())
+    {
+        return;
+    }
+
+    // NOTE: Keep entries for other CPUs so a home directory shared between hosts works,
+    // but drop this CPU's stale entries from earlier boots.
+    std::string cpu_prefix = GetCPUSignature() + " ";
+    std::filesystem::path path = std::filesystem::path(directory) / TIMER_CACHE_FILE_NAME;
+    std::vector<std::string> lines;
+    {
+        std::ifstream cache(path);
+        std::string line;
+        while (std::getline(cache, line))
+        {
+            if (line.compare(0, cpu_prefix.size(), cpu_prefix) != 0) lines.push_back(line);
+        }
+    }
+    lines.push_back(key + " " + std::to_string(freq));
+
+    std::filesystem::path temp_path = path;
+    temp_path += ".tmp";
+    {
+        std::ofstream cache(temp_path, std::ios::trunc);
+        for (auto& line : lines) cache << line << "\n";
+        if (!cache) return;
+    }
+    std::error_code error;
+    std::filesystem::rename(temp_path, path, error);
+}
+
+static TimerCalibration CalibrateCPUTimer()
+{
+    TimerCalibration result = {};
+
+    #if defined(__APPLE__) && defined(__arm64__)
+    uint64_t cntfrq;
+    asm volatile("mrs %0, CNTFRQ_EL0" : "=r"(cntfrq));
+    if (cntfrq) return { cntfrq, TIMER_FREQ_ARCH_REGISTER };
+    #elif defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+    if (uint64_t freq = ReadCPUIDTimerFreq()) return { freq, TIMER_FREQ_CPUID };
+    if (uint64_t freq = ReadHypervisorTimerFreq()) return { freq, TIMER_FREQ_HYPERVISOR };
+    #endif
+
+    // NOTE: Mainline Linux doesn't export its calibrated TSC frequency anywhere readable,
+    // so AMD parts (no leaf 0x15) and VMs without the timing leaf always end up here.
+    std::string key = GetTimerCacheKey();
+    if (uint64_t freq = ReadCachedTimerFreq(key)) return { freq, TIMER_FREQ_CACHED };
+
+    result.cpu_timer_freq_ = MeasureCPUTimerFreq();
+    result.source_ = TIMER_FREQ_MEASURED;
+    WriteCachedTimerFreq(key, result.cpu_timer_freq_);
+    return result;
+}
+
+const TimerCalibration& GetTimerCalibration()
+{
+    static TimerCalibration calibration = CalibrateCPUTimer();
+    return calibration;
+}
+
+uint64_t GetCPUTimerFreq()
+{
+    return GetTimerCalibration().cpu_timer_freq_;
+}
+
+char const* TimerFreqSourceName(TimerFreqSource source)
+{
+    switch (source)
+    {
+        case TIMER_FREQ_ARCH_REGISTER: return "counter register";
+        case TIMER_FREQ_CPUID: return "cpuid";
+        case TIMER_FREQ_HYPERVISOR: return "hypervisor";
+        case TIMER_FREQ_CACHED: return "cached";
+        case TIMER_FREQ_MEASURED: return "measured";
+        default: return "unknown";
+    }
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <cstdint>
+
+enum TimerFreqSource : uint32_t
+{
+    TIMER_FREQ_UNKNOWN,
+    TIMER_FREQ_ARCH_REGISTER, // architectural counter frequency register (ARM CNTFRQ_EL0)
+    TIMER_FREQ_CPUID,         // CPUID leaf 0x15 (with 0x16 supplying the crystal if needed)
+    TIMER_FREQ_HYPERVISOR,    // hypervisor timing leaf 0x40000010
+    TIMER_FREQ_CACHED,        // an earlier measurement on this CPU and boot, read from disk
+    TIMER_FREQ_MEASURED,      // measured against the OS timer on this run
+};
+
+struct TimerCalibration
+{
+    uint64_t cpu_timer_freq_;
+    TimerFreqSource source_;
+};
+
+// NOTE: Resolved once per process and cached. Only the last fallback busy-waits, and
+// its result is written to the cache directory so it happens at most once per boot.
+const TimerCalibration& GetTimerCalibration();
+uint64_t GetCPUTimerFreq();
+char const* TimerFreqSourceName(TimerFreqSource source);